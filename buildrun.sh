@@ -1,3 +1,4 @@
 #!/bin/sh
-make
+# usage: buildrun.sh [kr|tlsf|buddy]
+make -B HEAP=${1:-kr}
 ls ./traces/trace* | xargs ./test_heap
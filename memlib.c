@@ -15,16 +15,49 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/mman.h>
 
 #include "memlib.h"
 /*
- * Default maximum heap size in bytes
+ * Default maximum heap size in bytes, overridden by the environment
+ * variable MEM_MAX_HEAP (bytes, or with a suffix k, m or g) or by
+ * mem_set_maxheapsize()
  */
 #ifndef MAX_HEAP
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 #endif
+/*
+ * Largest number of regions the heap can be split into
+ */
+#define MAX_REGIONS 64
+/*
+ * Alignment of the start of the heap: a huge page, so that blocks
+ * aligned relative to the heap start are aligned in memory
+ */
+#ifndef MEM_HEAP_ALIGN
+#define MEM_HEAP_ALIGN (2*(1<<20))  /* 2 MB */
+#endif
+/*
+ * With MEM_RESERVE defined, the address range of the heap is only
+ * reserved, and the pages of each region are committed as its break
+ * advances, so memory past a break cannot be accessed, as with the
+ * system sbrk. Otherwise the whole heap is mapped up front.
+ */
+#ifdef MEM_RESERVE
+#define MEM_PROT PROT_NONE
+#else
+#define MEM_PROT (PROT_READ | PROT_WRITE)
+#endif
 
 /* private variables */
+/** maximum heap size in bytes */
+static size_t mem_max_heap = MAX_HEAP;
+
+/** true if mem_max_heap was set by mem_set_maxheapsize() */
+static bool mem_max_heap_set = false;
+
 /** points to first byte of heap */
 static void *mem_start_brk = NULL;
 
@@ -34,55 +67,231 @@ static void *mem_brk = NULL;
 /** largest legal heap address */
 static void *mem_max_addr = NULL;
 
+/** number of regions of the heap, region 0 is the heap of mem_sbrk */
+static int mem_nregions = 1;
+
+/** size of each region in bytes */
+static size_t mem_region_size = MAX_HEAP;
+
+/** break of each region other than region 0 (mem_brk) */
+static char *mem_region_brk[MAX_REGIONS];
+
+#ifdef MEM_RESERVE
+/** end of the committed pages of each region */
+static char *mem_region_commit[MAX_REGIONS];
+#endif
+
+/**
+ * mem_getenv_maxheap - get the maximum heap size from the environment
+ *    variable MEM_MAX_HEAP.
+ *
+ * @return the size in bytes, or 0 if not set or not valid
+ */
+static size_t mem_getenv_maxheap(void) {
+    const char *s = getenv("MEM_MAX_HEAP");
+    if (s == NULL || *s == '\0') {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (errno != 0 || end == s || *end != '\0' || n > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+    return (size_t)n << shift;
+}
+
+/**
+ * mem_set_maxheapsize - set the maximum heap size of the memory system
+ *    model, overriding MAX_HEAP and MEM_MAX_HEAP. The size is rounded
+ *    up to a multiple of the page size and takes effect when the heap
+ *    is next initialized, so it must be set before mem_init() or
+ *    after mem_deinit().
+ *
+ * @param nbytes the maximum heap size in bytes
+ * @return 0 if set, or -1 if the heap is initialized or nbytes is 0
+ */
+int mem_set_maxheapsize(size_t nbytes) {
+    if (mem_start_brk != NULL || nbytes == 0 || nbytes > SIZE_MAX - mem_pagesize()) {
+        return -1;
+    }
+    mem_max_heap = (nbytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    mem_max_heap_set = true;
+    return 0;
+}
+
 /**
  * mem_init - initialize the memory system model.
  */
 void mem_init(void) {
 	if (mem_start_brk == NULL) {
-		/* allocate the storage we will use to model the available VM */
-		mem_start_brk = (char *)malloc(MAX_HEAP);
-		if (mem_start_brk == NULL) {
-//	  		fprintf(stderr, "mem_init_vm: malloc error\n");
+		size_t max_heap = mem_getenv_maxheap();
+		if (!mem_max_heap_set && max_heap > 0 && max_heap <= SIZE_MAX - mem_pagesize()) {
+			mem_max_heap = (max_heap + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+		}
+
+		/* map the storage we will use to model the available VM, zero
+		 * until written like memory the system maps for a heap */
+		size_t align = (mem_pagesize() > MEM_HEAP_ALIGN) ? mem_pagesize() : MEM_HEAP_ALIGN;
+		char *p = mmap(NULL, mem_max_heap + align, MEM_PROT,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+//	  		fprintf(stderr, "mem_init_vm: mmap error\n");
 			exit(1);
 		}
+		/* unmap the storage before and after the aligned heap */
+		size_t lead = -(uintptr_t)p & (align - 1);
+		if (lead > 0) {
+			munmap(p, lead);
+		}
+		munmap(p + lead + mem_max_heap, align - lead);
+		mem_start_brk = p + lead;
 
-		mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+		mem_max_addr = mem_start_brk + mem_max_heap;  /* max legal heap address */
 		mem_brk = mem_start_brk;                  /* heap is empty initially */
+		mem_nregions = 1;
+		mem_region_size = mem_max_heap;
+#ifdef MEM_RESERVE
+		mem_region_commit[0] = mem_start_brk;
+#endif
 	}
 }
 
+/**
+ * mem_commit - commit the pages of a region up to a new break.
+ *
+ * @param region the region
+ * @param brk the new break of the region
+ * @return true if the pages are committed
+ */
+static bool mem_commit(int region, char *brk) {
+#ifdef MEM_RESERVE
+    char *end = mem_region_commit[region];
+    if (brk > end) {
+        size_t len = (size_t)(brk - end + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+        if (mprotect(end, len, PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+        mem_region_commit[region] = end + len;
+    }
+#else
+    (void)region;
+    (void)brk;
+#endif
+    return true;
+}
+
+/**
+ * mem_split - split the empty heap into nregions regions of equal
+ *    size, each a multiple of the page size with its own break.
+ *    Region 0 starts at mem_heap_lo() and is the heap of mem_sbrk.
+ *
+ * @param nregions the number of regions
+ * @return the number of regions, or -1 if the heap is not empty
+ */
+int mem_split(int nregions) {
+    if (mem_start_brk == NULL) {
+    	mem_init();
+    }
+    if (mem_heapsize() != 0) {
+        return -1;
+    }
+    if (nregions > MAX_REGIONS) {
+        nregions = MAX_REGIONS;
+    }
+    if (nregions < 1 || mem_max_heap / (size_t)nregions < mem_pagesize()) {
+        nregions = 1;
+    }
+
+    mem_nregions = nregions;
+    mem_region_size = (mem_max_heap / nregions) & ~(mem_pagesize() - 1);
+    for (int region = 1; region < nregions; region++) {
+        mem_region_brk[region] = mem_region_lo(region);
+    }
+#ifdef MEM_RESERVE
+    for (int region = 0; region < nregions; region++) {
+        mem_region_commit[region] = mem_region_lo(region);
+    }
+#endif
+    return nregions;
+}
+
 /**
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void) {
-    free(mem_start_brk);
+    munmap(mem_start_brk, mem_max_heap);
     mem_start_brk = mem_max_addr = mem_brk = 0;
+    mem_nregions = 1;
+    mem_region_size = mem_max_heap;
+}
+
+/**
+ * mem_discard - discard the memory of a region from a new break lo
+ *    to its old break brk, so that it reads as zero when next used:
+ *    the pages are discarded and decommitted, and the rest of the page
+ *    of lo is cleared.
+ *
+ * @param region the region
+ * @param lo the new break of the region
+ * @param brk the old break of the region
+ */
+static void mem_discard(int region, char *lo, char *brk) {
+    char *page = (char *)(((uintptr_t)lo + mem_pagesize() - 1) & ~(uintptr_t)(mem_pagesize() - 1));
+    if (page > lo) {
+        memset(lo, 0, (size_t)(((page < brk) ? page : brk) - lo));
+    }
+    if (brk > page) {
+        madvise(page, (size_t)(brk - page + mem_pagesize() - 1) & ~(mem_pagesize() - 1),
+                MADV_DONTNEED);
+    }
+#ifdef MEM_RESERVE
+    if (mem_region_commit[region] > page) {
+        mprotect(page, (size_t)(mem_region_commit[region] - page), PROT_NONE);
+        mem_region_commit[region] = page;
+    }
+#else
+    (void)region;
+#endif
 }
 
 /**
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    whose discarded pages read as zero
  */
 void mem_reset_brk() {
+    mem_discard(0, mem_start_brk, mem_brk);
     mem_brk = mem_start_brk;
+    for (int region = 1; region < mem_nregions; region++) {
+        mem_discard(region, mem_region_lo(region), mem_region_brk[region]);
+        mem_region_brk[region] = mem_region_lo(region);
+    }
 }
 
 /**
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap is shrunk by mem_trim(), and the new area
+ *    is zero.
  *
  * @param incr amount of memory to extend heap in bytes
  * @return pointer to old break point
  */
-void *mem_sbrk(int incr) {
-    char *old_brk = mem_brk;
-
+void *mem_sbrk(size_t incr) {
     // initialize memory if not already initialized
     if (mem_start_brk == NULL) {
     	mem_init();
     }
+    char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr > (size_t)((char *)mem_start_brk + mem_region_size - old_brk))
+         || !mem_commit(0, (char *)mem_brk + incr)) {
 		errno = ENOMEM;
 //		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
@@ -91,6 +300,113 @@ void *mem_sbrk(int incr) {
     return (void *)old_brk;
 }
 
+/**
+ * mem_region_sbrk - mem_sbrk for the heap of a region.
+ *
+ * @param region the region
+ * @param incr amount of memory to extend the region in bytes
+ * @return pointer to old break point of the region
+ */
+void *mem_region_sbrk(int region, size_t incr) {
+    if (region == 0) {
+        return mem_sbrk(incr);
+    }
+
+    char *old_brk = mem_region_brk[region];
+    if ( (incr > (size_t)((char *)mem_region_lo(region) + mem_region_size - old_brk))
+         || !mem_commit(region, old_brk + incr)) {
+		errno = ENOMEM;
+		return (void *)-1;
+    }
+    mem_region_brk[region] += incr;
+    return (void *)old_brk;
+}
+
+/**
+ * mem_region_trim - shrink the heap of a region by decr bytes, the
+ *    opposite of mem_region_sbrk. The memory released reads as zero
+ *    when the heap grows over it again.
+ *
+ * @param region the region
+ * @param decr amount of memory to remove from the region in bytes
+ * @return pointer to old break point of the region, or -1 if the
+ *    heap of the region is smaller than decr bytes
+ */
+void *mem_region_trim(int region, size_t decr) {
+    char *lo = mem_region_lo(region);
+    char *old_brk = (region == 0) ? (char *)mem_brk : mem_region_brk[region];
+    if (mem_start_brk == NULL || decr > (size_t)(old_brk - lo)) {
+		errno = EINVAL;
+		return (void *)-1;
+    }
+    mem_discard(region, old_brk - decr, old_brk);
+    if (region == 0) {
+        mem_brk = old_brk - decr;
+    } else {
+        mem_region_brk[region] = old_brk - decr;
+    }
+    return (void *)old_brk;
+}
+
+/**
+ * mem_trim - shrink the heap by decr bytes, the opposite of mem_sbrk.
+ *
+ * @param decr amount of memory to remove from the heap in bytes
+ * @return pointer to old break point, or -1 if the heap is smaller
+ *    than decr bytes
+ */
+void *mem_trim(size_t decr) {
+    return mem_region_trim(0, decr);
+}
+
+/**
+ * mem_purge - return the whole pages in len bytes of the heap at lo
+ *    to the system. They stay part of the heap and read as zero when
+ *    next used.
+ *
+ * @param lo the start of the memory
+ * @param len the length of the memory in bytes
+ * @return the number of bytes purged
+ */
+size_t mem_purge(void *lo, size_t len) {
+    uintptr_t start = ((uintptr_t)lo + mem_pagesize() - 1) & ~(uintptr_t)(mem_pagesize() - 1);
+    uintptr_t end = ((uintptr_t)lo + len) & ~(uintptr_t)(mem_pagesize() - 1);
+    if (end <= start || madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    return end - start;
+}
+
+/**
+ * mem_region_lo - return address of the first byte of a region.
+ *
+ * @param region the region
+ * @return address of the first byte of the region
+ */
+void *mem_region_lo(int region) {
+    return (char *)mem_start_brk + region * mem_region_size;
+}
+
+/**
+ * mem_region_hi - return address of the last heap byte of a region.
+ *
+ * @param region the region
+ * @return address of the last heap byte of the region
+ */
+void *mem_region_hi(int region) {
+    return (region == 0) ? mem_heap_hi() : (void *)(mem_region_brk[region] - 1);
+}
+
+/**
+ * mem_region_of - return the region of a heap address.
+ *
+ * @param p the heap address
+ * @return the region holding the address
+ */
+int mem_region_of(void *p) {
+    return (int)((size_t)((char *)p - (char *)mem_start_brk) / mem_region_size);
+}
+
 /**
  * mem_heap_lo - return address of the first heap byte.
  *
@@ -111,13 +427,28 @@ void *mem_heap_hi()
 }
 
 /**
- * mem_heapsize() - returns the heap size in bytes.
+ * mem_heapsize() - returns the heap size in bytes, the sum of the
+ *    heap sizes of all regions.
  *
  * @returns the heap size in bytes
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = (size_t)(mem_brk - mem_start_brk);
+    for (int region = 1; region < mem_nregions; region++) {
+        size += (size_t)(mem_region_brk[region] - (char *)mem_region_lo(region));
+    }
+    return size;
+}
+
+/**
+ * mem_maxheapsize() - returns the largest heap size in bytes.
+ *
+ * @returns the largest heap size in bytes
+ */
+size_t mem_maxheapsize()
+{
+    return mem_max_heap;
 }
 
 /**
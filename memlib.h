@@ -11,6 +11,17 @@
  * @author philip gust
  */
 
+/**
+ * mem_set_maxheapsize - set the maximum heap size of the memory system
+ *    model, overriding MAX_HEAP and the environment variable MEM_MAX_HEAP.
+ *    It takes effect when the heap is next initialized, so it must be
+ *    set before mem_init() or after mem_deinit().
+ *
+ * @param nbytes the maximum heap size in bytes
+ * @return 0 if set, or -1 if the heap is initialized or nbytes is 0
+ */
+int mem_set_maxheapsize(size_t nbytes);
+
 /**
  * mem_init - initialize the memory system model.
  */
@@ -23,16 +34,95 @@ void mem_deinit(void);
 
 /**
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    whose discarded pages read as zero
  */
 void mem_reset_brk(void);
 
 /**
  * mem_sbrk - simple model of the sbrk function. Extends the heap
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap is shrunk by mem_trim(), and the new area
+ *    is zero: memory past the break reads as zero, as it is discarded
+ *    when the heap is reset or trimmed. Built with MEM_RESERVE, the pages of the
+ *    new area are committed here and memory past the break faults.
  * @return starting address of new area, or -1 if out of memory
  */
-void *mem_sbrk(int incr);
+void *mem_sbrk(size_t incr);
+
+/**
+ * mem_split - split the empty heap into nregions regions of equal
+ *    size, each a multiple of the page size with its own break.
+ *    Region 0 starts at mem_heap_lo() and is the heap of mem_sbrk.
+ *
+ * @param nregions the number of regions
+ * @return the number of regions, or -1 if the heap is not empty
+ */
+int mem_split(int nregions);
+
+/**
+ * mem_region_sbrk - mem_sbrk for the heap of a region.
+ *
+ * @param region the region
+ * @param incr amount of memory to extend the region in bytes
+ * @return starting address of new area, or -1 if out of memory
+ */
+void *mem_region_sbrk(int region, size_t incr);
+
+/**
+ * mem_trim - shrink the heap by decr bytes, the opposite of mem_sbrk.
+ *    The memory released reads as zero when the heap grows over it
+ *    again.
+ *
+ * @param decr amount of memory to remove from the heap in bytes
+ * @return pointer to old break point, or -1 if the heap is smaller
+ *    than decr bytes
+ */
+void *mem_trim(size_t decr);
+
+/**
+ * mem_region_trim - mem_trim for the heap of a region.
+ *
+ * @param region the region
+ * @param decr amount of memory to remove from the region in bytes
+ * @return pointer to old break point of the region, or -1 if the
+ *    heap of the region is smaller than decr bytes
+ */
+void *mem_region_trim(int region, size_t decr);
+
+/**
+ * mem_purge - return the whole pages in len bytes of the heap at lo
+ *    to the system. They stay part of the heap and read as zero when
+ *    next used.
+ *
+ * @param lo the start of the memory
+ * @param len the length of the memory in bytes
+ * @return the number of bytes purged
+ */
+size_t mem_purge(void *lo, size_t len);
+
+/**
+ * mem_region_lo - return address of the first byte of a region.
+ *
+ * @param region the region
+ * @return address of the first byte of the region
+ */
+void *mem_region_lo(int region);
+
+/**
+ * mem_region_hi - return address of the last heap byte of a region.
+ *
+ * @param region the region
+ * @return address of the last heap byte of the region
+ */
+void *mem_region_hi(int region);
+
+/**
+ * mem_region_of - return the region of a heap address.
+ *
+ * @param p the heap address
+ * @return the region holding the address
+ */
+int mem_region_of(void *p);
 
 /**
  * mem_heap_lo - return address of the first heap byte.
@@ -49,12 +139,20 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 
 /**
- * mem_heapsize() - returns the heap size in bytes.
+ * mem_heapsize() - returns the heap size in bytes, the sum of the
+ *    heap sizes of all regions.
  *
  * @return heap size in bytes
  */
 size_t mem_heapsize(void);
 
+/**
+ * mem_maxheapsize() - returns the largest heap size in bytes.
+ *
+ * @return largest heap size in bytes
+ */
+size_t mem_maxheapsize(void);
+
 /**
  * mem_pagesize() - returns the page size of the system.
  *
@@ -0,0 +1,890 @@
+/*
+ * mm_buddy_heap.c
+ *
+ * Binary buddy memory manager. Every block is a power of two in
+ * size and aligned to its size relative to the start of the heap,
+ * so the buddy a block splits from or merges with is found by
+ * flipping one bit of its offset. Free blocks are kept on one
+ * list per order, with a bitmap of the non-empty orders.
+ *
+ * Blocks carry no header or footer: the order and free state of
+ * each block are kept in a map with one byte per minimum-size
+ * block, so power-of-two requests use exactly one block.
+ *
+ *  @since Oct 16, 2026
+ *  @author agent
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include "memlib.h"
+#include "mm_heap.h"
+
+
+/** Free block: links of its free list are kept in the block itself */
+typedef struct Block {
+    struct Block *next;     /** next free block of the same order */
+    struct Block *prev;     /** previous free block of the same order */
+} Block;
+
+/** Log2 of the smallest block: must hold the free list links */
+#define BUDDY_MIN_ORDER 4
+/** Number of orders (one bit each in the order bitmap) */
+#define BUDDY_NORDERS 64
+/** Flag in the block map for a block on a free list */
+#define BUDDY_FREE 0x80
+/** Mask for the order in the block map */
+#define BUDDY_ORDER 0x7f
+
+/**
+ * When a free block of at least MM_PURGE_MIN bytes results from
+ * mm_free, its whole pages are returned to the system. 0 disables
+ * purging.
+ */
+#ifndef MM_PURGE_MIN
+#define MM_PURGE_MIN (256 * 1024)
+#endif
+
+/*
+ * Check whether multiply overflows (true if overflow)
+ * Extracted from:
+ *   https://github.com/Cloudef/chck/blob/master/chck/overflow/overflow.h
+ */
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+#if __GNUC__ >= 5 || __has_builtin(__builtin_add_overflow)
+/* assume clang and gcc (>=5) to only have builtins for now. */
+#define mul_of(a, b, r) __builtin_mul_overflow(a, b, r)
+#else
+/* else use generic, note behaviour is not strictly defined in C. */
+#define mul_of(a, b, r) (((*(r) = ((a) * (b))) || *(r) == 0) && ((a) != 0 && (b) > *(r) / (a)))
+#endif
+
+/** Heads of the free lists, one per order */
+static Block *freelists[BUDDY_NORDERS];
+/** Bit n set if freelists[n] is non-empty */
+static uint64_t ordermap = 0;
+/**
+ * Order and free flag of the block starting at each minimum-size
+ * block of the heap (grown with the system realloc, outside
+ * the heap it describes)
+ */
+static unsigned char *blockmap = NULL;
+/** Number of entries in blockmap */
+static size_t blockmap_len = 0;
+/** Running heap statistics (heap_size and largest_free computed) */
+static struct mm_stats stats;
+
+/**
+ * Empty all the free lists.
+ */
+static void mm_clearlists(void) {
+    memset(freelists, 0, sizeof(freelists));
+    ordermap = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Initialize memory allocator
+ */
+void mm_init(void) {
+	mem_init();
+    mm_clearlists();
+}
+
+/**
+ * Reset memory allocator.
+ */
+void mm_reset(void) {
+    mem_reset_brk();
+    mm_clearlists();
+    // no block is free, as mm_trim expects of entries past a block start
+    if (blockmap != NULL) {
+        memset(blockmap, 0, blockmap_len);
+    }
+}
+
+/**
+ * De-initialize memory allocator.
+ */
+void mm_deinit(void) {
+	mem_deinit();
+    mm_clearlists();
+    free(blockmap);
+    blockmap = NULL;
+    blockmap_len = 0;
+}
+
+/**
+ * Order of the smallest block that holds nbytes bytes.
+ *
+ * @param nbytes number of bytes
+ * @return log2 of the block size
+ */
+inline static int mm_order(size_t nbytes) {
+    if (nbytes <= ((size_t)1 << BUDDY_MIN_ORDER)) {
+        return BUDDY_MIN_ORDER;
+    }
+    return sizeof(unsigned long) * CHAR_BIT - __builtin_clzl(nbytes - 1);
+}
+
+/**
+ * Allocation bytes for a block of an order.
+ *
+ * @param order log2 of the block size
+ * @return number of bytes in the block
+ */
+inline static size_t mm_bytes(int order) {
+    return (size_t)1 << order;
+}
+
+/**
+ * Offset of a block from the start of the heap.
+ *
+ * @param bp the block pointer
+ */
+inline static size_t mm_offset(Block *bp) {
+    return (size_t)((char *)bp - (char *)mem_heap_lo());
+}
+
+/**
+ * Block map entry of a block.
+ *
+ * @param bp the block pointer
+ */
+inline static unsigned char *mm_tag(Block *bp) {
+    return &blockmap[mm_offset(bp) >> BUDDY_MIN_ORDER];
+}
+
+/**
+ * get order of a block
+ *
+ * @param bp the block pointer
+ */
+inline static int mm_getOrder(Block *bp) {
+    return *mm_tag(bp) & BUDDY_ORDER;
+}
+
+/**
+ * get buddy of a block of an order (NULL if past the end of the heap)
+ *
+ * @param bp the block pointer
+ * @param order the order of the block
+ */
+inline static Block *mm_buddy(Block *bp, int order) {
+    size_t off = mm_offset(bp) ^ mm_bytes(order);
+    if (off + mm_bytes(order) > mem_heapsize()) {
+        return NULL;
+    }
+    return (Block *)((char *)mem_heap_lo() + off);
+}
+
+/**
+ * unlink the block from the free list of its order
+ *
+ * @param bp the block pointer
+ * @param order the order of the block
+ */
+inline static void mm_unlink(Block *bp, int order) {
+    stats.free_bytes -= mm_bytes(order);
+    stats.free_blocks--;
+    if (bp->prev != NULL) {
+        bp->prev->next = bp->next;
+    } else {
+        freelists[order] = bp->next;
+        if (bp->next == NULL) {
+            ordermap &= ~((uint64_t)1 << order);
+        }
+    }
+    if (bp->next != NULL) {
+        bp->next->prev = bp->prev;
+    }
+    *mm_tag(bp) = order;
+}
+
+/**
+ * link block into the head of the free list of its order
+ *
+ * @param bp the block pointer
+ * @param order the order of the block
+ */
+inline static void mm_link(Block *bp, int order) {
+    stats.free_bytes += mm_bytes(order);
+    stats.free_blocks++;
+    bp->prev = NULL;
+    bp->next = freelists[order];
+    if (bp->next != NULL) {
+        bp->next->prev = bp;
+    }
+    freelists[order] = bp;
+    ordermap |= (uint64_t)1 << order;
+    *mm_tag(bp) = BUDDY_FREE | order;
+}
+
+/**
+ * Merge a block with its free buddies and link the result
+ * into the free list of its order.
+ *
+ * @param bp the block to release
+ * @param order the order of the block
+ * @return the merged free block
+ */
+static Block *mm_release(Block *bp, int order) {
+    for (Block *buddy; (buddy = mm_buddy(bp, order)) != NULL; order++) {
+        if (*mm_tag(buddy) != (BUDDY_FREE | order)) {
+            break;  // buddy allocated or split
+        }
+        mm_unlink(buddy, order);
+        if (buddy < bp) {
+            bp = buddy;
+        }
+    }
+    mm_link(bp, order);
+    return bp;
+}
+
+/**
+ * Release a block and, if the free block that results has at least
+ * MM_PURGE_MIN bytes, return the whole pages that the release newly
+ * joined to the system. A free block of that size was already purged
+ * when it formed, and buddies merge in increasing order, so only the
+ * aligned block of the purge order holding the released block is,
+ * or the released block if it is larger.
+ *
+ * @param bp the block to release
+ * @param order the order of the block
+ * @return the merged free block
+ */
+static Block *mm_release_purge(Block *bp, int order) {
+    Block *fp = mm_release(bp, order);
+    if (MM_PURGE_MIN == 0 || mm_bytes(mm_getOrder(fp)) < MM_PURGE_MIN) {
+        return fp;
+    }
+    int k = mm_order(MM_PURGE_MIN);
+    if (k < order) {
+        k = order;
+    }
+    if (k > mm_getOrder(fp)) {
+        k = mm_getOrder(fp);
+    }
+    char *lo = (char *)mem_heap_lo() + (mm_offset(bp) & ~(mm_bytes(k) - 1));
+    size_t len = mm_bytes(k);
+    if (lo == (char *)fp) {
+        // the free list links of the block stay in use
+        lo += sizeof(Block);
+        len -= sizeof(Block);
+    }
+    mem_purge(lo, len);
+    return fp;
+}
+
+/**
+ * Ensure the block map covers a heap of nbytes bytes.
+ *
+ * @param nbytes the heap size in bytes
+ * @return true if the map covers the heap
+ */
+static bool mm_growmap(size_t nbytes) {
+    size_t len = nbytes >> BUDDY_MIN_ORDER;
+    if (len <= blockmap_len) {
+        return true;
+    }
+    if (len < 2 * blockmap_len) {
+        len = 2 * blockmap_len;
+    }
+    unsigned char *map = realloc(blockmap, len);
+    if (map == NULL) {
+        return false;
+    }
+    blockmap = map;
+    blockmap_len = len;
+    return true;
+}
+
+/**
+ * Request additional memory to be added to this process.
+ * The heap is first extended to a multiple of the block size
+ * with smaller aligned blocks that go to the free lists.
+ *
+ * @param order the order of the block to add
+ * @return true if a free block of the order was added
+ */
+static bool morecore(int order) {
+    size_t size = mm_bytes(order);
+    size_t top = mem_heapsize();
+    // end of new block at the next aligned offset
+    size_t end = ((top + size - 1) & ~(size - 1)) + size;
+    if (!mm_growmap(end)) {
+        return false;
+    }
+    stats.sbrk_calls++;
+    if (mem_sbrk(end - top) == (void *)-1) {	// no space
+        return false;
+    }
+    if (mem_heapsize() > stats.peak_heap) {
+        stats.peak_heap = mem_heapsize();
+    }
+
+    // largest aligned blocks that fill the gap below the new block
+    while (top < end - size) {
+        int k = __builtin_ctzl(top);
+        while (top + mm_bytes(k) > end - size) {
+            k--;
+        }
+        mm_release((Block *)((char *)mem_heap_lo() + top), k);
+        top += mm_bytes(k);
+    }
+    mm_release((Block *)((char *)mem_heap_lo() + top), order);
+    return true;
+}
+
+/**
+ * Allocates size bytes of memory and returns a pointer to the
+ * allocated memory, or NULL if request storage cannot be allocated.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc(size_t nbytes) {
+    int order = mm_order(nbytes);
+    if (order >= BUDDY_NORDERS - 1) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // smallest non-empty order that can satisfy the request
+    uint64_t map = ordermap & (~(uint64_t)0 << order);
+    if (map == 0) {
+        if (!morecore(order)) {
+            errno = ENOMEM;
+            return NULL;                /* none left */
+        }
+        map = ordermap & (~(uint64_t)0 << order);
+    }
+
+    int k = __builtin_ctzll(map);
+    Block *bp = freelists[k];
+    mm_unlink(bp, k);
+    // split, returning the upper halves to the free lists
+    while (k > order) {
+        k--;
+        mm_link((Block *)((char *)bp + mm_bytes(k)), k);
+    }
+    *mm_tag(bp) = order;
+    stats.alloc_bytes += mm_bytes(order);
+    stats.alloc_blocks++;
+    return bp;
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ */
+void mm_free(void *ap) {
+	// ignore null pointer
+    if (ap == NULL) {
+        return;
+    }
+
+    Block *bp = ap;
+    // validate block map entry of the block
+    assert(ap >= mem_heap_lo() && ap <= mem_heap_hi() && !(*mm_tag(bp) & BUDDY_FREE));
+    stats.alloc_bytes -= mm_bytes(mm_getOrder(bp));
+    stats.alloc_blocks--;
+    mm_release_purge(bp, mm_getOrder(bp));
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap, whose size
+ * the caller knows: the size requested for it, or at most its
+ * usable size. The order of the block
+ * is kept in the block map, as the block may be larger than the
+ * size implies, so the size is only checked, if MM_CHECK_FREE_SIZE
+ * is defined.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ * @param nbytes the size of the allocation in bytes
+ */
+void mm_free_sized(void *ap, size_t nbytes) {
+#ifdef MM_CHECK_FREE_SIZE
+    assert(ap == NULL || nbytes <= mm_malloc_usable_size(ap));
+#else
+    (void)nbytes;
+#endif
+    mm_free(ap);
+}
+
+/**
+ * Tries to change the size of the allocation pointed to by ap
+ * to size, and returns ap.
+ *
+ * If there is not enough room to enlarge the memory allocation
+ * pointed to by ap, realloc() creates a new allocation, copies
+ * as much of the old data pointed to by ptr as will fit to the
+ * new allocation, frees the old allocation, and returns a pointer
+ * to the allocated memory.
+ *
+ * If ap is NULL, realloc() is identical to a call to malloc()
+ * for size bytes.  If size is zero and ptr is not NULL, a minimum
+ * sized object is allocated and the original object is freed.
+ *
+ * @param ap pointer to allocated memory
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void* mm_realloc(void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_malloc(newsize);
+	}
+
+	Block* bp = ap;
+	size_t oldsize = mm_bytes(mm_getOrder(bp));
+	if (newsize > 0) {
+		// return this ap if allocated block large enough
+		if (oldsize >= newsize) {
+			return ap;
+		}
+	}
+
+	// allocate new block
+	void *newap = mm_malloc(newsize);
+	if (newap == NULL) {
+		return NULL;
+	}
+	// copy old block to new block
+	memcpy(newap, ap, (oldsize < newsize) ? oldsize : newsize);
+	mm_free(ap);
+	return newap;
+}
+
+/**
+ * Contiguously allocates enough space for count objects that are
+ * size bytes of memory each and returns a pointer to the allocated
+ * memory.  The allocated memory is filled with bytes of value zero.
+ *
+ * @param count the number of blocks to allocate
+ * @param size the size of each element
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void* mm_calloc(size_t count, size_t size) {
+	// multiply and check for overflow
+	size_t nbytes; // product
+	if (mul_of(count, size, &nbytes)) { // overflow if true
+		return NULL;
+	}
+
+	void* p = mm_malloc(nbytes);
+	if (p != NULL) {
+		memset(p, 0, nbytes);
+	}
+	return p;
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align.
+ * A block is aligned to its size relative to the start of the
+ * heap, which memlib aligns to a huge page, so a block of at
+ * least align bytes is aligned in memory for alignments up to
+ * that of the heap start.
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_memalign(size_t align, size_t nbytes) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void *ap = mm_malloc((nbytes < align) ? align : nbytes);
+    if (ap != NULL && ((uintptr_t)ap & (align - 1)) != 0) {
+        // alignment larger than that of the heap start
+        mm_free(ap);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ap;
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as C11 aligned_alloc().
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_aligned_alloc(size_t align, size_t nbytes) {
+    return mm_memalign(align, nbytes);
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as POSIX posix_memalign(). Unlike the other allocation
+ * functions, errno is not set.
+ *
+ * @param pp the location for the allocated memory
+ * @param align the alignment in bytes, a power of two multiple
+ *  of sizeof(void *)
+ * @param nbytes the number of bytes to allocate
+ * @return 0, EINVAL if align is not valid, or ENOMEM if not available
+ */
+int mm_posix_memalign(void **pp, size_t align, size_t nbytes) {
+    if (align < sizeof(void *) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    int err = errno;
+    void *ap = mm_memalign(align, nbytes);
+    errno = err;
+    if (ap == NULL) {
+        return ENOMEM;
+    }
+    *pp = ap;
+    return 0;
+}
+
+/**
+ * Get the number of bytes usable in the memory allocation pointed
+ * to by ap, at least the number requested for it.
+ *
+ * @param ap pointer to allocated memory, or NULL
+ * @return the usable size in bytes, or 0 if ap is NULL
+ */
+size_t mm_malloc_usable_size(void *ap) {
+    if (ap == NULL) {
+        return 0;
+    }
+    return mm_bytes(mm_getOrder(ap));
+}
+
+/**
+ * Allocates at least nbytes bytes and reports the usable size of
+ * the allocation, so the caller can use all of its rounded block.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @param actual the location for the usable size, or NULL
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc_at_least(size_t nbytes, size_t *actual) {
+    void *ap = mm_malloc(nbytes);
+    if (ap != NULL && actual != NULL) {
+        *actual = mm_malloc_usable_size(ap);
+    }
+    return ap;
+}
+
+/**
+ * Allocates n objects of nbytes bytes each and stores the pointers
+ * to them in ptrs. Each is a block of its own order, found in
+ * constant time, so objects are allocated one at a time. Fewer
+ * objects are allocated only if memory runs out.
+ *
+ * @param nbytes the number of bytes of each object
+ * @param n the number of objects
+ * @param ptrs the location for the n pointers
+ * @return the number of objects allocated
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void **ptrs) {
+    size_t count = 0;
+    while (count < n && (ptrs[count] = mm_malloc(nbytes)) != NULL) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Allocates n objects of the sizes in sizes and stores the pointers
+ * to them in ptrs. Blocks are aligned to their own size, so the
+ * objects are adjacent only where their orders allow. Each object
+ * is freed on its own.
+ *
+ * @param n the number of objects
+ * @param sizes the number of bytes of each object
+ * @param ptrs the location for the n pointers
+ * @return ptrs or NULL if not available, with no objects allocated
+ */
+void **mm_malloc_multi(size_t n, const size_t *sizes, void **ptrs) {
+    for (size_t i = 0; i < n; i++) {
+        if ((ptrs[i] = mm_malloc(sizes[i])) == NULL) {
+            while (i > 0) {
+                mm_free(ptrs[--i]);
+            }
+            return NULL;
+        }
+    }
+    return ptrs;
+}
+
+/**
+ * Compare two pointers by address for qsort().
+ *
+ * @param p1 pointer to the first pointer
+ * @param p2 pointer to the second pointer
+ * @return negative, zero or positive as the first address is lower,
+ *  equal or higher
+ */
+static int mm_ptrcmp(const void *p1, const void *p2) {
+    uintptr_t a1 = (uintptr_t)*(void * const *)p1;
+    uintptr_t a2 = (uintptr_t)*(void * const *)p2;
+    return (a1 > a2) - (a1 < a2);
+}
+
+/**
+ * Deallocates the n memory allocations pointed to by ptrs, in
+ * increasing address order, so that a freed block finds its free
+ * lower buddy. The ptrs are sorted in place; NULL pointers are
+ * ignored.
+ *
+ * @param ptrs the memory to free
+ * @param n the number of pointers
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if ((uintptr_t)ptrs[i - 1] > (uintptr_t)ptrs[i]) {
+            qsort(ptrs, n, sizeof(void *), mm_ptrcmp);
+            break;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        mm_free(ptrs[i]);
+    }
+}
+
+/**
+ * Extend the heap so that a free block of at least nbytes bytes
+ * is on the free lists.
+ *
+ * @param nbytes the number of bytes to reserve
+ * @return 0 if reserved, or -1 if not available
+ */
+int mm_reserve(size_t nbytes) {
+    int order = mm_order(nbytes);
+    if (order >= BUDDY_NORDERS - 1 || !morecore(order)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Free block that ends at an offset of the heap. Only the entries
+ * of free blocks in the block map have BUDDY_FREE set, so an entry
+ * of order k with the flag at end - 2^k is the block.
+ *
+ * @param end the offset
+ * @return the free block, or NULL if the block before end is allocated
+ */
+static Block *mm_freebefore(size_t end) {
+    for (int k = BUDDY_MIN_ORDER; k < BUDDY_NORDERS - 1 && mm_bytes(k) <= end; k++) {
+        size_t off = end - mm_bytes(k);
+        Block *bp = (Block *)((char *)mem_heap_lo() + off);
+        if ((off & (mm_bytes(k) - 1)) == 0 && *mm_tag(bp) == (BUDDY_FREE | k)) {
+            return bp;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns free memory at the end of the heap to the system by
+ * shrinking the heap, one free block at a time from the end, as
+ * long as at least pad bytes of free blocks stay at the end so that
+ * requests up to a block of that size do not need to grow the heap
+ * again.
+ *
+ * @param pad the number of free bytes to keep at the end of the heap
+ * @return 1 if memory was returned, otherwise 0
+ */
+int mm_trim(size_t pad) {
+    if (pad > SIZE_MAX / 2) {
+        return 0;
+    }
+    // bytes of the free blocks at the end of the heap
+    size_t run = 0;
+    for (Block *bp; (bp = mm_freebefore(mem_heapsize() - run)) != NULL; ) {
+        run += mm_bytes(mm_getOrder(bp));
+    }
+    int res = 0;
+    for (Block *bp; (bp = mm_freebefore(mem_heapsize())) != NULL; res = 1) {
+        int order = mm_getOrder(bp);
+        if (run < pad + mm_bytes(order)) {
+            break;
+        }
+        mm_unlink(bp, order);
+        mem_trim(mm_bytes(order));
+        run -= mm_bytes(order);
+    }
+    return res;
+}
+
+/** Object of a heap handle, linked into the list of its heap */
+typedef struct HeapObj {
+    struct HeapObj *next;   /** next object of the heap */
+    struct HeapObj *prev;   /** previous object of the heap */
+} HeapObj;
+
+/**
+ * Heap handle: the circular list of its objects. Destroying the
+ * heap frees its objects one at a time.
+ */
+struct mm_heap {
+    HeapObj objs;           /** list head */
+};
+
+/**
+ * Link an object into the list of a heap.
+ *
+ * @param hp the heap
+ * @param op the object
+ */
+inline static void mm_heap_link(mm_heap_t *hp, HeapObj *op) {
+    op->next = hp->objs.next;
+    op->prev = &hp->objs;
+    op->next->prev = op;
+    hp->objs.next = op;
+}
+
+/**
+ * Unlink an object from the list of its heap.
+ *
+ * @param op the object
+ */
+inline static void mm_heap_unlink(HeapObj *op) {
+    op->prev->next = op->next;
+    op->next->prev = op->prev;
+}
+
+/**
+ * Create a heap whose objects are all released at once when the
+ * heap is destroyed.
+ *
+ * @return the heap or NULL if not available
+ */
+mm_heap_t *mm_heap_create(void) {
+    mm_heap_t *hp = mm_malloc(sizeof(mm_heap_t));
+    if (hp != NULL) {
+        hp->objs.next = hp->objs.prev = &hp->objs;
+    }
+    return hp;
+}
+
+/**
+ * Allocates nbytes bytes from a heap.
+ *
+ * @param hp the heap
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_heap_malloc(mm_heap_t *hp, size_t nbytes) {
+    if (nbytes > SIZE_MAX - sizeof(HeapObj)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    HeapObj *op = mm_malloc(sizeof(HeapObj) + nbytes);
+    if (op == NULL) {
+        return NULL;
+    }
+    mm_heap_link(hp, op);
+    return op + 1;
+}
+
+/**
+ * Deallocates memory allocated from a heap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param hp the heap
+ * @param ap the memory to free
+ */
+void mm_heap_free(mm_heap_t *hp, void *ap) {
+    (void)hp;
+    if (ap == NULL) {
+        return;
+    }
+    HeapObj *op = (HeapObj *)ap - 1;
+    mm_heap_unlink(op);
+    mm_free(op);
+}
+
+/**
+ * Changes the size of memory allocated from a heap, as mm_realloc().
+ *
+ * @param hp the heap
+ * @param ap pointer to memory allocated from the heap
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void *mm_heap_realloc(mm_heap_t *hp, void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_heap_malloc(hp, newsize);
+	}
+    if (newsize > SIZE_MAX - sizeof(HeapObj)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    HeapObj *op = (HeapObj *)ap - 1;
+    mm_heap_unlink(op);
+    HeapObj *np = mm_realloc(op, sizeof(HeapObj) + newsize);
+    if (np == NULL) {
+        mm_heap_link(hp, op);
+        return NULL;
+    }
+    mm_heap_link(hp, np);
+    return np + 1;
+}
+
+/**
+ * Destroy a heap, releasing all memory allocated from it.
+ *
+ * @param hp the heap
+ */
+void mm_heap_destroy(mm_heap_t *hp) {
+    if (hp == NULL) {
+        return;
+    }
+    HeapObj *op = hp->objs.next;
+    while (op != &hp->objs) {
+        HeapObj *next = op->next;
+        mm_free(op);
+        op = next;
+    }
+    mm_free(hp);
+}
+
+/**
+ * Calculate the total amount of available free memory.
+ *
+ * @return the amount of free memory in bytes
+ */
+size_t mm_getfree(void) {
+    return stats.free_bytes;
+}
+
+/**
+ * Get statistics of the heap. The largest free block is a block of
+ * the highest order in the order map, all other values are counted
+ * as the heap changes.
+ *
+ * @param sp the statistics to fill in
+ */
+void mm_stats(struct mm_stats *sp) {
+    *sp = stats;
+    sp->heap_size = mem_heapsize();
+    sp->largest_free = (ordermap != 0) ? mm_bytes(63 - __builtin_clzll(ordermap)) : 0;
+}
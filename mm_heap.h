@@ -11,6 +11,21 @@
 #ifndef MM_HEAP_H_
 #define MM_HEAP_H_
 
+/** Heap statistics reported by mm_stats() */
+struct mm_stats {
+    size_t free_bytes;      /** bytes available for allocation */
+    size_t free_blocks;     /** number of free blocks */
+    size_t alloc_bytes;     /** usable bytes of allocated memory */
+    size_t alloc_blocks;    /** number of allocated blocks */
+    size_t largest_free;    /** size in bytes of the largest free block, or of one in its size class */
+    size_t heap_size;       /** heap size in bytes */
+    size_t peak_heap;       /** largest heap size in bytes */
+    size_t sbrk_calls;      /** number of calls to mem_sbrk() */
+};
+
+/** Heap whose objects are released together by mm_heap_destroy() */
+typedef struct mm_heap mm_heap_t;
+
 /**
  * Initialize memory allocator.
  */
@@ -33,6 +48,13 @@ void mm_deinit(void);
  */
 size_t mm_getfree(void);
 
+/**
+ * Get statistics of the heap.
+ *
+ * @param sp the statistics to fill in
+ */
+void mm_stats(struct mm_stats *sp);
+
 
 /**
  * Allocates size bytes of memory and returns a pointer to the
@@ -62,6 +84,20 @@ void* mm_calloc(size_t count, size_t size);
  */
 void mm_free(void *ap);
 
+/**
+ * Deallocates the memory allocation pointed to by ap, whose size
+ * the caller knows: the size requested for it, or at most its
+ * usable size. The size is only a hint: the thread-safe kr heap
+ * uses it to cache small objects without reading their block
+ * header, and every other path frees as mm_free() does. Define
+ * MM_CHECK_FREE_SIZE to check the size.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ * @param nbytes the size of the allocation in bytes
+ */
+void mm_free_sized(void *ap, size_t nbytes);
+
 /**
  * Reallocates size bytes of memory and returns a pointer to the
  * allocated memory, or NULL if request storage cannot be allocated.
@@ -72,5 +108,156 @@ void mm_free(void *ap);
  */
 void *mm_realloc(void *ap, size_t size);
 
+/**
+ * Allocates nbytes bytes whose address is a multiple of align.
+ * The memory is released by mm_free() and resized by mm_realloc(),
+ * which keeps the alignment only if it does not move the memory.
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_memalign(size_t align, size_t nbytes);
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as C11 aligned_alloc().
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_aligned_alloc(size_t align, size_t nbytes);
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as POSIX posix_memalign(). Unlike the other allocation
+ * functions, errno is not set.
+ *
+ * @param pp the location for the allocated memory
+ * @param align the alignment in bytes, a power of two multiple
+ *  of sizeof(void *)
+ * @param nbytes the number of bytes to allocate
+ * @return 0, EINVAL if align is not valid, or ENOMEM if not available
+ */
+int mm_posix_memalign(void **pp, size_t align, size_t nbytes);
+
+/**
+ * Get the number of bytes usable in the memory allocation pointed
+ * to by ap, at least the number requested for it. The allocation
+ * must not be from a heap handle.
+ *
+ * @param ap pointer to allocated memory, or NULL
+ * @return the usable size in bytes, or 0 if ap is NULL
+ */
+size_t mm_malloc_usable_size(void *ap);
+
+/**
+ * Allocates at least nbytes bytes and reports the usable size of
+ * the allocation, so the caller can use all of its rounded block.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @param actual the location for the usable size, or NULL
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc_at_least(size_t nbytes, size_t *actual);
+
+/**
+ * Allocates n objects of nbytes bytes each in one call and stores
+ * the pointers to them in ptrs. Fewer objects are allocated only
+ * if memory runs out.
+ *
+ * @param nbytes the number of bytes of each object
+ * @param n the number of objects
+ * @param ptrs the location for the n pointers
+ * @return the number of objects allocated
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void **ptrs);
+
+/**
+ * Allocates n objects of the sizes in sizes adjacent in memory and
+ * stores the pointers to them in ptrs. Each object is freed on its
+ * own.
+ *
+ * @param n the number of objects
+ * @param sizes the number of bytes of each object
+ * @param ptrs the location for the n pointers
+ * @return ptrs or NULL if not available, with no objects allocated
+ */
+void **mm_malloc_multi(size_t n, const size_t *sizes, void **ptrs);
+
+/**
+ * Deallocates the n memory allocations pointed to by ptrs, in
+ * increasing address order so that adjacent blocks are released
+ * together. The ptrs are sorted in place; NULL pointers are ignored.
+ *
+ * @param ptrs the memory to free
+ * @param n the number of pointers
+ */
+void mm_free_batch(void **ptrs, size_t n);
+
+/**
+ * Extends the heap up front so that an allocation of nbytes bytes
+ * can be served without growing the heap.
+ *
+ * @param nbytes the number of bytes to reserve
+ * @return 0 if reserved, or -1 if not available
+ */
+int mm_reserve(size_t nbytes);
+
+/**
+ * Returns free memory at the end of the heap to the system by
+ * shrinking the heap, keeping pad bytes of it so that requests up
+ * to that size do not need to grow the heap again.
+ *
+ * @param pad the number of free bytes to keep at the end of the heap
+ * @return 1 if memory was returned, otherwise 0
+ */
+int mm_trim(size_t pad);
+
+/**
+ * Create a heap whose objects are all released at once when the
+ * heap is destroyed. A heap does not survive mm_reset().
+ *
+ * @return the heap or NULL if not available
+ */
+mm_heap_t *mm_heap_create(void);
+
+/**
+ * Allocates nbytes bytes from a heap.
+ *
+ * @param hp the heap
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_heap_malloc(mm_heap_t *hp, size_t nbytes);
+
+/**
+ * Deallocates memory allocated from a heap, which must not be
+ * passed to mm_free(). If ap is a NULL pointer, no operation is
+ * performed.
+ *
+ * @param hp the heap
+ * @param ap the memory to free
+ */
+void mm_heap_free(mm_heap_t *hp, void *ap);
+
+/**
+ * Reallocates memory allocated from a heap, as mm_realloc().
+ *
+ * @param hp the heap
+ * @param ap the currently allocated storage
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_heap_realloc(mm_heap_t *hp, void *ap, size_t nbytes);
+
+/**
+ * Destroy a heap, releasing all memory allocated from it.
+ *
+ * @param hp the heap
+ */
+void mm_heap_destroy(mm_heap_t *hp);
+
 
 #endif /* MM_HEAP_H_ */
@@ -10,32 +10,224 @@
  */
 
 
+#if defined(MM_RSEQ) && !defined(_GNU_SOURCE)
+// sched_setaffinity(), for mm_trim() to empty the cache of each CPU
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#endif
+// per-CPU caches need the rseq area glibc registers on x86-64 Linux;
+// they are left out under ThreadSanitizer, which cannot see that
+// restartable sequences on one CPU are ordered
+#ifdef MM_RSEQ
+#if defined(MM_THREAD_SAFE) && defined(__linux__) && defined(__x86_64__) \
+    && !defined(__SANITIZE_THREAD__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sched.h>
+#include <sys/rseq.h>
+#else
+#undef MM_RSEQ
+#endif
+#else
+#undef MM_RSEQ
+#endif
+#endif
 #include "memlib.h"
 #include "mm_heap.h"
 
 
-/** Allocation unit for header of memory blocks */
-typedef union Header {
-    struct {
-        union Header *ptr;  /** next block if on free list */
-        size_t size;        /** size of this block including header */
-                            /** measured in multiple of header size */
-    } s;
-    max_align_t _align;     /** force alignment to max align boundary */
+/**
+ * Header of memory blocks. Every block starts with a size word
+ * holding its size in bytes and the MM_ALLOC and MM_PREV_FREE flags.
+ * Only free blocks end with a copy of it (the footer), which the
+ * block after finds through its MM_PREV_FREE flag. The free list
+ * links are only present in free blocks, in the space that is
+ * payload of allocated blocks.
+ */
+typedef struct Header {
+    size_t size;            /** size of this block in bytes and flags */
+    struct Header *next;    /** next block if on free list */
+    struct Header *prev;    /** previous block if on free list */
 } Header;
 
+/** Size of the block header and footer words */
+#define MM_WSIZE sizeof(size_t)
+/** Alignment of payloads and block sizes */
+#define MM_ALIGN 16
+/** Flag in the size word of an allocated block */
+#define MM_ALLOC ((size_t)1)
+/** Flag in the size word of a block whose block before is free */
+#define MM_PREV_FREE ((size_t)2)
+/**
+ * Flag in the size word of a free block whose payload is zero but
+ * for its free list links and footer, as memory fresh from mem_sbrk
+ * is, and of a block just allocated from such a block
+ */
+#define MM_ZERO ((size_t)4)
+/** Mask for the flags in the size word */
+#define MM_FLAGS ((size_t)(MM_ALIGN - 1))
+/** Bytes of an allocated block that are not payload (the header) */
+#define MM_OVERHEAD MM_WSIZE
+/** Smallest block: header, free list links and footer */
+#define MM_MIN_BLOCK ((sizeof(Header) + MM_WSIZE + MM_ALIGN - 1) & ~MM_FLAGS)
+
+/**
+ * Segregated free lists: block sizes below MM_EXACT_CLASSES units
+ * of MM_ALIGN bytes each have their own exact-size class, larger
+ * blocks are grouped into power-of-two ranges [2^k, 2^(k+1)) units.
+ * One bit per class in the class map records whether its list is
+ * non-empty.
+ */
+#define MM_EXACT_SHIFT 4
+#define MM_EXACT_CLASSES (1 << MM_EXACT_SHIFT)
+#define MM_NCLASSES 64
+
+/**
+ * Requests of at most MM_SLAB_MAX bytes are served from slabs:
+ * page-aligned, page-sized blocks holding objects of one size
+ * class, in multiples of MM_SLAB_ALIGN bytes. 0 disables slabs.
+ */
+#ifndef MM_SLAB_MAX
+#define MM_SLAB_MAX 256
+#endif
+#define MM_SLAB_ALIGN MM_ALIGN
+#define MM_SLAB_CLASSES ((MM_SLAB_MAX + MM_SLAB_ALIGN - 1) / MM_SLAB_ALIGN + 1)
+
+/**
+ * The heap grows by a chunk of at least one page that doubles with
+ * every growth up to MM_GROW_MAX bytes. A page or less disables
+ * geometric growth.
+ */
+#ifndef MM_GROW_MAX
+#define MM_GROW_MAX (64 * 1024)
+#endif
+
+/**
+ * When a free block of at least MM_PURGE_MIN bytes results from
+ * mm_free, its whole pages are returned to the system and the rest
+ * of its payload is cleared, leaving a zero block. 0 disables
+ * purging.
+ */
+#ifndef MM_PURGE_MIN
+#define MM_PURGE_MIN (256 * 1024)
+#endif
+
+/**
+ * With MM_THREAD_SAFE defined, the heap is protected by a lock and
+ * each thread caches free objects of up to MM_TCACHE_MAX bytes, one
+ * list per MM_ALIGN size class, to serve mm_malloc and mm_free
+ * without the lock. An empty list is refilled and a full list is
+ * flushed MM_TCACHE_BATCH objects at a time under one lock.
+ */
+#ifndef MM_TCACHE_MAX
+#define MM_TCACHE_MAX 512
+#endif
+#ifndef MM_TCACHE_BATCH
+#define MM_TCACHE_BATCH 16
+#endif
+#define MM_TCACHE_CLASSES (MM_TCACHE_MAX / MM_ALIGN)
+
+/**
+ * With MM_RSEQ also defined, the cached objects are kept per CPU
+ * rather than per thread, MM_PCPU_SLOTS per class, and are pushed
+ * and popped in restartable sequences (rseq) that the kernel aborts
+ * if the thread is preempted or migrated. Threads for which glibc
+ * did not register rseq use their thread cache.
+ */
+#ifndef MM_PCPU_SLOTS
+#define MM_PCPU_SLOTS (2 * MM_TCACHE_BATCH)
+#endif
+
+/**
+ * The heap is split into MM_ARENAS arenas, each with its own free
+ * lists and slabs in its own region of the simulated heap, so that
+ * threads assigned to different arenas do not contend for a lock.
+ * A thread frees an object of another arena without its lock by
+ * pushing it onto the remote free list of the arena, which is
+ * drained the next time the arena allocates.
+ */
+#ifndef MM_ARENAS
+#ifdef MM_THREAD_SAFE
+#define MM_ARENAS 4
+#else
+#define MM_ARENAS 1
+#endif
+#endif
+
+/** Free objects cached by a thread */
+typedef struct TCache {
+    void *bins[MM_TCACHE_CLASSES];      /** object lists linked through their first word */
+    unsigned count[MM_TCACHE_CLASSES];  /** number of objects on each list */
+    unsigned generation;                /** heap generation the objects belong to */
+    size_t nobjs;                       /** number of objects on all the lists */
+    size_t nbytes;                      /** usable bytes of the objects on all the lists */
+} TCache;
+
+/** Free objects cached for a CPU */
+typedef struct CpuCache {
+    size_t nbytes;                                  /** usable bytes of the objects (of any CPU cache) */
+    size_t count[MM_TCACHE_CLASSES];                /** number of objects of each class */
+    void *slots[MM_TCACHE_CLASSES][MM_PCPU_SLOTS];  /** objects of each class */
+} CpuCache;
+
+/** Descriptor at the start of the payload of a slab page */
+typedef struct Slab {
+    struct Slab *next;      /** next slab of the class with free objects */
+    struct Slab *prev;      /** previous slab of the class with free objects */
+    void *free;             /** list of free objects in the slab */
+    size_t size;            /** object size in bytes */
+    size_t nfree;           /** number of free objects */
+    size_t nobjs;           /** number of objects */
+} Slab;
+
+/** Arena: a heap in its own region of the simulated heap */
+typedef struct Arena {
+    Header *freelists[MM_NCLASSES];     /** heads of the circular free lists, one per size class */
+    uint64_t classmap;                  /** bit n set if freelists[n] is non-empty */
+    Slab *slabs[MM_SLAB_CLASSES];       /** slabs with free objects, one list per slab class */
+    size_t growsize;                    /** bytes of the next growth of the heap (0 until first growth) */
+    struct mm_stats stats;              /** running heap statistics (heap_size and largest_free computed) */
+    int region;                         /** region of the simulated heap, -1 for a heap handle */
+    struct Chunk *chunks;               /** chunks of a heap handle, newest first */
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_t lock;               /** lock of the arena */
+    void *remote;                       /** objects freed by threads of other arenas */
+    size_t remote_blocks;               /** number of objects on the remote list */
+    size_t remote_bytes;                /** usable bytes of the objects on the remote list */
+#endif
+} Arena;
+
+/** Link at the start of a chunk of a heap handle */
+typedef struct Chunk {
+    struct Chunk *next;     /** next older chunk */
+    struct Chunk *prev;     /** next newer chunk */
+} Chunk;
+
+/** Heap handle: an arena whose heap is chunks allocated from the arenas */
+struct mm_heap {
+    Arena arena;
+};
+
 // forward declarations
-static Header *morecore(size_t);
+static Header *morecore(Arena *a, size_t);
 void visualize(const char*);
 inline static Header *mm_next(Header *bp);
-inline static void mm_unlink(Header *bp);
+inline static void mm_unlink(Arena *a, Header *bp);
+static Header *mm_release(Arena *a, Header *bp);
+static void mm_central_free(Arena *a, void *ap);
+static bool mm_slab_initmap(void);
+inline static size_t mm_arena_size(Arena *a);
 
 /*
  * Check whether multiply overflows (true if overflow)
@@ -54,14 +246,126 @@ inline static void mm_unlink(Header *bp);
 #endif
 
 static bool debug = false;
-/** Start of free memory list */
-static Header *freep = NULL;
+/** The arenas */
+static Arena arenas[MM_ARENAS];
+/** Number of arenas in use (regions the heap was split into) */
+static int narenas = 1;
+/** Bit n set if heap page n holds a slab (system malloc, outside the heap) */
+static uint64_t *slabmap = NULL;
+/** Number of words in slabmap */
+static size_t slabmap_len = 0;
+/** log2 of the page size */
+static size_t pageshift = 0;
+/** Bytes of the regions of all the arenas */
+static size_t heap_total = 0;
+/** Largest value of heap_total since the heap was reset */
+static size_t heap_peak = 0;
+
+#ifdef MM_THREAD_SAFE
+#define MM_LOCK(a) pthread_mutex_lock(&(a)->lock)
+#define MM_UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+/** Generation of the heap, advanced when the heap is reset */
+static unsigned generation = 1;
+/** Arena of this thread (NULL until first use) */
+static __thread Arena *tarena;
+/** Arena to assign to the next thread */
+static unsigned nextarena = 0;
+/** Cache of free objects of this thread */
+static __thread TCache tcache;
+/** Key whose destructor flushes the cache of an exiting thread */
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#ifdef MM_RSEQ
+/** Per-CPU caches (system malloc, like the slab map) */
+static CpuCache *cpucaches = NULL;
+/** Number of per-CPU caches */
+static unsigned ncpus = 0;
+#endif
+/** Words also accessed without the heap lock are accessed atomically */
+#define MM_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define MM_OR(p, v) __atomic_fetch_or(p, v, __ATOMIC_RELAXED)
+#define MM_AND(p, v) __atomic_fetch_and(p, v, __ATOMIC_RELAXED)
+#define MM_ADD(p, v) __atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#define MM_SUB(p, v) __atomic_sub_fetch(p, v, __ATOMIC_RELAXED)
+#define MM_CAS(p, old, v) __atomic_compare_exchange_n(p, old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define MM_LOCK(a)
+#define MM_UNLOCK(a)
+#define MM_LOAD(p) (*(p))
+#define MM_OR(p, v) (*(p) |= (v))
+#define MM_AND(p, v) (*(p) &= (v))
+#define MM_ADD(p, v) (*(p) += (v))
+#define MM_SUB(p, v) (*(p) -= (v))
+#define MM_CAS(p, old, v) (*(p) = (v), true)
+#endif
+
+/**
+ * Empty all the free lists.
+ */
+static void mm_clearlists(void) {
+#ifdef MM_THREAD_SAFE
+    // objects in thread caches are gone with the heap
+    generation++;
+#endif
+    for (int i = 0; i < MM_ARENAS; i++) {
+        Arena *a = &arenas[i];
+        memset(a->freelists, 0, sizeof(a->freelists));
+        a->classmap = 0;
+        memset(a->slabs, 0, sizeof(a->slabs));
+        a->growsize = 0;
+        memset(&a->stats, 0, sizeof(a->stats));
+#ifdef MM_THREAD_SAFE
+        a->remote = NULL;
+        a->remote_blocks = 0;
+        a->remote_bytes = 0;
+#endif
+    }
+    heap_total = 0;
+    heap_peak = 0;
+    if (slabmap != NULL) {
+        memset(slabmap, 0, slabmap_len * sizeof(uint64_t));
+    }
+#ifdef MM_RSEQ
+    if (cpucaches != NULL) {
+        memset(cpucaches, 0, ncpus * sizeof(CpuCache));
+    }
+#endif
+}
+
 /**
- * Initialize memory allocator
+ * Initialize memory allocator. The heap is split into one region
+ * per arena. If the heap is not empty, as when mm_init() is called
+ * again without mm_reset(), it cannot be split: then one arena is
+ * used, which grows region 0 on top of the memory already there and
+ * never frees that memory.
  */
 void mm_init(void) {
 	mem_init();
-    freep = NULL;
+    mm_clearlists();
+    mm_slab_initmap();
+    // one region of the heap per arena, or one arena if not empty
+    narenas = mem_split(MM_ARENAS);
+    if (narenas == -1) {
+        narenas = 1;
+    }
+    for (int i = 0; i < MM_ARENAS; i++) {
+        arenas[i].region = i;
+#ifdef MM_THREAD_SAFE
+        pthread_mutex_init(&arenas[i].lock, NULL);
+#endif
+    }
+    // memory already in region 0 counts toward the peak heap size
+    heap_total = mm_arena_size(&arenas[0]);
+    heap_peak = heap_total;
+#ifdef MM_RSEQ
+    // per-CPU caches only if glibc registered rseq
+    if (cpucaches == NULL && __rseq_size != 0) {
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+        if (n > 0 && (cpucaches = calloc(n, sizeof(CpuCache))) != NULL) {
+            ncpus = n;
+        }
+    }
+#endif
 }
 
 /**
@@ -70,7 +374,7 @@ void mm_init(void) {
 void mm_reset(void) {
     if (debug) visualize("RESET");
     mem_reset_brk();
-    freep = NULL;
+    mm_clearlists();
 }
 
 /**
@@ -78,29 +382,99 @@ void mm_reset(void) {
  */
 void mm_deinit(void) {
 	mem_deinit();
-    freep = NULL;
+    mm_clearlists();
+    free(slabmap);
+    slabmap = NULL;
+    slabmap_len = 0;
+#ifdef MM_THREAD_SAFE
+    for (int i = 0; i < MM_ARENAS; i++) {
+        pthread_mutex_destroy(&arenas[i].lock);
+    }
+#endif
+#ifdef MM_RSEQ
+    free(cpucaches);
+    cpucaches = NULL;
+    ncpus = 0;
+#endif
 }
 
+#ifdef MM_RSEQ
 /**
- * Allocation units for nbytes bytes.
+ * Get the rseq area of the calling thread.
  *
- * @param nbytes number of bytes
- * @return number of units for nbytes
+ * @return the rseq area, or NULL if per-CPU caches cannot be used
+ */
+inline static struct rseq *mm_rseq(void) {
+    if (cpucaches == NULL) {
+        return NULL;
+    }
+    struct rseq *rs = (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+    // cpu_id is negative if rseq is not registered for the thread
+    if (MM_LOAD(&rs->cpu_id) >= ncpus) {
+        return NULL;
+    }
+    return rs;
+}
+#endif
+
+/**
+ * Get the arena of the calling thread. Threads are assigned to
+ * arenas round-robin on first use, or by their current CPU when
+ * per-CPU caches are used.
+ *
+ * @return the arena
+ */
+inline static Arena *mm_arena(void) {
+#ifdef MM_RSEQ
+    struct rseq *rs = mm_rseq();
+    if (rs != NULL) {
+        return &arenas[MM_LOAD(&rs->cpu_id_start) % narenas];
+    }
+#endif
+#ifdef MM_THREAD_SAFE
+    if (tarena == NULL) {
+        tarena = &arenas[__atomic_fetch_add(&nextarena, 1, __ATOMIC_RELAXED) % narenas];
+    }
+    return tarena;
+#else
+    return &arenas[0];
+#endif
+}
+
+/**
+ * Get the arena that owns an allocated payload from the region
+ * of the simulated heap it is in.
+ *
+ * @param ap the allocated payload pointer
+ * @return the arena
+ */
+inline static Arena *mm_arena_of(void *ap) {
+    return (narenas == 1) ? &arenas[0] : &arenas[mem_region_of(ap)];
+}
+
+/**
+ * Get the heap size of an arena.
+ *
+ * @param a the arena
+ * @return the bytes of its region in use, or of its chunks
  */
-inline static size_t mm_units(size_t nbytes) {
-    /* smallest count of Header-sized memory chunks */
-    /*  (+1 additional chunk for the Header itself) needed to hold nbytes */
-    return (nbytes + 2 * sizeof(Header) - 1) / sizeof(Header) + 1;
+inline static size_t mm_arena_size(Arena *a) {
+    if (a->region < 0) {
+        return a->stats.heap_size;
+    }
+    return (size_t)((char *)mem_region_hi(a->region) + 1 - (char *)mem_region_lo(a->region));
 }
 
 /**
- * Allocation bytes for nunits allocation units.
+ * Block size for a payload of nbytes bytes.
  *
- * @param nunits number of units
- * @return number of bytes for nunits
+ * @param nbytes number of bytes
+ * @return size of the smallest block holding nbytes
  */
-inline static size_t mm_bytes(size_t nunits) {
-    return nunits * sizeof(Header);
+inline static size_t mm_blocksize(size_t nbytes) {
+    /* payload plus header, rounded up to the alignment */
+    size_t size = (nbytes + MM_OVERHEAD + MM_ALIGN - 1) & ~MM_FLAGS;
+    return (size < MM_MIN_BLOCK) ? MM_MIN_BLOCK : size;
 }
 
 /**
@@ -110,7 +484,7 @@ inline static size_t mm_bytes(size_t nunits) {
  * @return pointer to allocated payload
  */
 inline static void *mm_payload(Header *bp) {
-	return bp + 1;
+	return (char *)bp + MM_WSIZE;
 }
 
 /**
@@ -119,401 +493,2341 @@ inline static void *mm_payload(Header *bp) {
  * @param ap the allocated payload pointer
  */
 inline static Header *mm_block(void *ap) {
-	return (Header*)ap - 1;
+	return (Header *)((char *)ap - MM_WSIZE);
 }
+
 /**
- *  get pointer to block footer from header pointer 
+ * get size of block in bytes
  *
- * @param hp the header pointer
+ * @param bp the block pointer
  */
-inline static Header *mm_footer(Header *hp) {      
-    return hp + hp->s.size - 1;
+inline static size_t mm_size(Header *bp) {
+    return bp->size & ~MM_FLAGS;
 }
+
 /**
- * get pointer to block header from footer pointer
+ * get whether a block is free; the block may be allocated to a
+ * thread that clears its MM_ZERO flag without the lock
  *
- * @param ap the footer pointer
+ * @param bp the block pointer
  */
-inline static Header *mm_header(Header *fp) {
-    return fp - fp->s.size + 1;
+inline static bool mm_isFree(Header *bp) {
+    return !(MM_LOAD(&bp->size) & MM_ALLOC);
 }
 
 /**
- * get size of blocks in header units
+ * get whether the block before a block is free
  *
  * @param bp the block pointer
  */
-inline static size_t mm_size(Header *bp) {
-    return bp->s.size;
+inline static bool mm_isPrevFree(Header *bp) {
+    return bp->size & MM_PREV_FREE;
+}
+
+/**
+ *  get pointer to free block footer from header pointer
+ *
+ * @param bp the block pointer
+ */
+inline static size_t *mm_footer(Header *bp) {
+    return (size_t *)((char *)bp + mm_size(bp)) - 1;
+}
+
+/**
+ * set size of a free block in bytes: header, footer and the
+ * MM_PREV_FREE flag of the block after. Free blocks are always
+ * coalesced, so the block before is allocated.
+ *
+ * @param bp the block pointer
+ * @param size the block size
+ */
+inline static void mm_setFree(Header *bp, size_t size) {
+    bp->size = size;
+    *mm_footer(bp) = size;
+    MM_OR(&((Header *)((char *)bp + size))->size, MM_PREV_FREE);
 }
+
 /**
- * set size of block in header units 
+ * set size of an allocated block in bytes: header, keeping its
+ * MM_PREV_FREE flag, and the MM_PREV_FREE flag of the block after
  *
  * @param bp the block pointer
+ * @param size the block size
  */
-inline static void mm_setSize(Header *bp, size_t size) {
-    bp->s.size = size;
-    mm_footer(bp)->s.size = size;
+inline static void mm_setAlloc(Header *bp, size_t size) {
+    bp->size = size | MM_ALLOC | (bp->size & MM_PREV_FREE);
+    MM_AND(&((Header *)((char *)bp + size))->size, ~MM_PREV_FREE);
 }
+
 /**
  * get next block in free list
  *
  * @param bp the block pointer
  */
 inline static Header *mm_next(Header *bp) {
-    return bp->s.ptr;
+    return bp->next;
 }
+
 /**
  * set next block in free list
  *
  * @param bp the block pointer
- * @param next the next block pointer 
+ * @param next the next block pointer
  */
 inline static void mm_setNext(Header *bp, Header *next) {
-    bp->s.ptr = next;
+    bp->next = next;
 }
+
 /**
  * get prev block in free list
  *
  * @param bp the block pointer
  */
 inline static Header *mm_prev(Header *bp) {
-   return mm_footer(bp)->s.ptr;
+   return bp->prev;
 }
+
 /**
  * set prev block in free list
  *
  * @param bp the block pointer
- * @param prev the prev block pointer 
+ * @param prev the prev block pointer
  */
 inline static void mm_setPrev(Header *bp, Header *prev) {
-    mm_footer(bp)->s.ptr = prev;
+    bp->prev = prev;
 }
+
 /**
- * get block before in memory (NULL if no block) 
+ * get free block before in memory (only if mm_isPrevFree(bp))
  *
  * @param bp the block pointer
  */
 inline static Header * mm_before(Header *bp) {
-    if ((void *) bp <= mem_heap_lo()) {
-        return NULL;
-    }
-    return mm_header(bp - 1);
+    size_t *fp = (size_t *)bp - 1;   // footer of block before
+    return (Header *)((char *)bp - (*fp & ~MM_FLAGS));
 }
+
 /**
- * get block after in memory (NULL if no block)
+ * get block after in memory (the epilogue header for the last block)
  *
  * @param bp the block pointer
  */
 inline static Header * mm_after(Header *bp) {
-    if ((void *)(bp + bp->s.size) > mem_heap_hi()) {
-        return NULL;
+    return (Header *)((char *)bp + mm_size(bp));
+}
+
+/**
+ * get size class of a block
+ *
+ * @param size the block size in bytes
+ * @return index of the free list for the size
+ */
+inline static size_t mm_class(size_t size) {
+    size_t nunits = size / MM_ALIGN;
+    if (nunits < MM_EXACT_CLASSES) {
+        return nunits;
     }
-    return bp + bp->s.size;
+    // one class per power of two above the exact classes
+    size_t log2 = sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(nunits);
+    size_t cls = MM_EXACT_CLASSES + log2 - MM_EXACT_SHIFT;
+    return (cls < MM_NCLASSES) ? cls : MM_NCLASSES - 1;
 }
 
 /**
- * unlink the block from free list
+ * unlink the block from its free list
  *
  * @param bp the block pointer
  */
-inline static void mm_unlink(Header *bp) {
+inline static void mm_unlink(Arena *a, Header *bp) {
+    size_t cls = mm_class(mm_size(bp));
+    a->stats.free_bytes -= mm_size(bp);
+    a->stats.free_blocks--;
     if (mm_next(bp) == bp) {
-        mm_setNext(bp, NULL);
-        mm_setPrev(bp, NULL);
-        freep = NULL;
-        return;
+        // last block in the list
+        a->freelists[cls] = NULL;
+        a->classmap &= ~((uint64_t)1 << cls);
     }
     else {
         Header * prev = mm_prev(bp);
         Header * next = mm_next(bp);
         mm_setNext(prev, next);
         mm_setPrev(next, prev);
-        mm_setNext(bp, NULL);
-        mm_setPrev(bp, NULL);
+        if (a->freelists[cls] == bp) {
+            a->freelists[cls] = next;
+        }
     }
-
 }
 
 /**
- * link block into free list
+ * link block into the head of the free list for its size
  *
  * @param bp the block pointer
  */
-inline static void mm_link(Header *bp, Header *pos) {
-    if (pos == NULL) {
+inline static void mm_link(Arena *a, Header *bp) {
+    size_t cls = mm_class(mm_size(bp));
+    a->stats.free_bytes += mm_size(bp);
+    a->stats.free_blocks++;
+    Header *head = a->freelists[cls];
+    if (head == NULL) {
         mm_setNext(bp, bp);
         mm_setPrev(bp, bp);
-        freep = bp;
-        return;
+        a->classmap |= (uint64_t)1 << cls;
+    } else {
+        Header *prev = mm_prev(head);
+        mm_setNext(prev, bp);
+        mm_setPrev(bp, prev);
+        mm_setNext(bp, head);
+        mm_setPrev(head, bp);
     }
-    Header *prev = mm_prev(pos);
-    mm_setNext(prev, bp);
-    mm_setPrev(bp, prev);
-    mm_setNext(bp, pos);
-    mm_setPrev(pos, bp);
+    a->freelists[cls] = bp;
 }
+
 /**
- * Allocates size bytes of memory and returns a pointer to the
- * allocated memory, or NULL if request storage cannot be allocated.
+ * Find a free block of at least size bytes in an arena. Blocks in an exact
+ * class or in a range class above that of size are always large
+ * enough, so the class map finds one directly. The head of the
+ * range class of size itself is tried first so that freed blocks
+ * of a recurring size are reused before larger blocks are split;
+ * the rest of that class is only searched when no larger class
+ * has blocks.
  *
- * @param nbytes the number of bytes to allocate
- * @return pointer to allocated memory or NULL if not available.
+ * @param size the required block size in bytes
+ * @return a free block or NULL if none large enough
  */
-void *mm_malloc(size_t nbytes) {
-    if (debug) visualize("PRE-MALLOC");
-    Header *p = NULL;
-    size_t nunits = mm_units(nbytes);
-    if (debug) fprintf(stderr, "nunits %zu\n", nunits);
-    if (freep == NULL) {
-        p = morecore(nunits);
-        if (p == NULL) {
-            errno = ENOMEM;
-            return NULL;                /* none left */
-        }
-        freep = p;
-    }
-
-    // smallest count of Header-sized memory chunks
-    //  (+1 additional chunk for the Header itself) needed to hold nbytes
-    // traverse the circular list to find a block
-    for (p = mm_next(freep); true ; p = mm_next(p)) {
-        if (p->s.size >= nunits) {          /* found block large enough */
-            if (debug) fprintf(stderr,"Found block %10p to allocate, size %zu \n", (void*) p, p->s.size);
-            if (p->s.size == nunits || p->s.size == nunits + 1) {
-				// free block exact size
-                if (debug) fprintf(stderr,"Exact fit \n"); 
-                if (freep == p) freep = mm_prev(p);             
-                mm_unlink(p);
-            } else {
-            	// split and allocate tail end
-                if (debug) fprintf(stderr,"Split \n");
-                Header *prev = mm_prev(p); 
-                Header *next = mm_next(p);
-                mm_setSize(p, mm_size(p) - nunits);
-                mm_setPrev(p, prev);
-                mm_setNext(p, next);
-                if (debug) fprintf(stderr,"First block in split size %zu\n", p->s.size);
-                /* find the address to return */
-                p += mm_size(p);		 // address upper block to return
-                mm_setSize(p, nunits);
-                mm_setNext(p, NULL);
-                mm_setPrev(p, NULL);
-                if (debug) fprintf(stderr,"Second block in split size %zu\n", p->s.size);
-                freep = prev;
-            }
-            if (debug) visualize("POST-MALLOC");
-            return mm_payload(p);
-        }
-
-        /* back where we started and nothing found - we need to allocate */
-        if (p == freep) {                    /* wrapped around free list */
-        	p = morecore(nunits);
-        	if (p == NULL) {
-                errno = ENOMEM;
-                return NULL;                /* none left */
+inline static Header *mm_find(Arena *a, size_t size) {
+    size_t cls = mm_class(size);
+    // head of the range class of size itself if it fits
+    if (cls >= MM_EXACT_CLASSES && a->freelists[cls] != NULL
+        && mm_size(a->freelists[cls]) >= size) {
+        return a->freelists[cls];
+    }
+    // first non-empty class whose blocks all satisfy the request
+    size_t fit = (cls < MM_EXACT_CLASSES) ? cls : cls + 1;
+    uint64_t map = (fit < MM_NCLASSES) ? a->classmap & (~(uint64_t)0 << fit) : 0;
+    if (map != 0) {
+        return a->freelists[__builtin_ctzll(map)];
+    }
+    // otherwise search the range class of size itself
+    Header *p = a->freelists[cls];
+    if (cls >= MM_EXACT_CLASSES && p != NULL) {
+        do {
+            if (mm_size(p) >= size) {
+                return p;
             }
-            freep = mm_prev(p);
-        }
+            p = mm_next(p);
+        } while (p != a->freelists[cls]);
     }
-
-    assert(false);  // shouldn't happen
-	return NULL;
+    return NULL;
 }
 
-
 /**
- * Deallocates the memory allocation pointed to by ap.
- * If ap is a NULL pointer, no operation is performed.
+ * Allocate a block of size bytes whose payload is aligned to
+ * align bytes, carving it out of a free block and returning the
+ * leading and trailing slack to the free lists.
  *
- * @param ap the memory to free
+ * @param a the arena
+ * @param size the block size in bytes
+ * @param align the alignment in bytes, a power of two multiple of MM_ALIGN
+ * @return the allocated block or NULL if not available
  */
-void mm_free(void *ap) {
-    if (debug) visualize("PRE-FREE");
-	// ignore null pointer
-    if (ap == NULL) {
-        return;
+static Header *mm_alloc_aligned(Arena *a, size_t size, size_t align) {
+    // large enough for the block at any alignment of a free block
+    size_t need = size + align + MM_MIN_BLOCK;
+    Header *p = mm_find(a, need);
+    if (p == NULL) {
+        if (morecore(a, need) == NULL) {
+            return NULL;
+        }
+        p = mm_find(a, need);
+        assert(p != NULL);
     }
 
-    Header *bp = mm_block(ap);   /* point to block header */
-    // validate size field of header block
-    assert(bp->s.size > 0 && mm_bytes(bp->s.size) <= mem_heapsize());
-    if (freep == NULL) { /* the list is empty. Add the first block to list */
-        if (debug) fprintf(stderr,"Empty free list. Init\n");
-        mm_setNext(bp, bp);
-        mm_setPrev(bp, bp);
-        freep = bp;
-        return;
+    mm_unlink(a, p);
+    size_t avail = mm_size(p);
+    size_t zero = p->size & MM_ZERO;
+    size_t lead = -(uintptr_t)mm_payload(p) & (align - 1);
+    while (lead > 0 && lead < MM_MIN_BLOCK) {
+        // too small to be a block: use next aligned address
+        lead += align;
     }
-    Header *pnext = NULL;
-    Header *p = NULL;
-    if (mm_after(bp) != NULL && mm_after(bp)->s.ptr != NULL) {
-		/* coalesce if adjacent to upper neighbor
-         *  unlink the upper block from free list and coalese
-         */
-        if (debug) fprintf(stderr,"Coalese upper \n");
-        pnext = mm_after(bp);
-        /* If the block to unlink happen to be freep, reset freep */
-        if (freep == pnext) freep = mm_prev(pnext); 
-        mm_unlink(pnext); 
-        mm_setSize(bp, mm_size(bp) + mm_size(pnext));
-        mm_setNext(bp, NULL);
-        mm_setPrev(bp, NULL);     
-    }
-    
-    if (mm_before(bp) != NULL && mm_before(bp)->s.ptr != NULL) {
-        /* coalesce if adjacent to lower block
-         *  unlink the lower block from free list and coalese
-         */
-        if (debug) fprintf(stderr,"Coalese lower \n");
-        p = mm_before(bp);
-        /* If the block to unlink happen to be freep, reset freep */
-        if (freep == p) freep = mm_prev(p);
-        mm_unlink(p);
-        mm_setSize(p, mm_size(p) + mm_size(bp));
-        mm_setNext(bp, NULL);
-        mm_setPrev(bp, NULL);
-        mm_setNext(p, NULL);
-        mm_setPrev(p, NULL);
-        // reset bp to where p is
-        bp = p;     
+    if (lead > 0) {
+        // return the leading slack to the free lists
+        mm_setFree(p, lead);
+        p->size |= zero;
+        mm_link(a, p);
+        p = (Header *)((char *)p + lead);
+        avail -= lead;
     }
-    /* link bp into the free list at freep, 
-     * bp could have been coaesced with upper/lower block already
-     */
-    mm_link(bp, freep);
-    /* reset the start of the free list */
-    freep = mm_prev(bp);
-    if (debug) visualize("POST-FREE");
+    if (avail - size >= MM_MIN_BLOCK) {
+        // return the trailing slack to the free lists
+        Header *rest = (Header *)((char *)p + size);
+        mm_setFree(rest, avail - size);
+        rest->size |= zero;
+        mm_link(a, rest);
+        avail = size;
+    }
+    mm_setAlloc(p, avail);
+    return p;
 }
 
 /**
- * Tries to change the size of the allocation pointed to by ap
- * to size, and returns ap.
- *
- * If there is not enough room to enlarge the memory allocation
- * pointed to by ap, realloc() creates a new allocation, copies
- * as much of the old data pointed to by ptr as will fit to the
- * new allocation, frees the old allocation, and returns a pointer
- * to the allocated memory.
+ * Allocate n adjacent blocks out of one free block, returning the
+ * rest of the free block to the free lists, with the arena lock
+ * held. The last block takes any rest too small to be a block.
  *
- * If ap is NULL, realloc() is identical to a call to malloc()
- * for size bytes.  If size is zero and ptr is not NULL, a minimum
- * sized object is allocated and the original object is freed.
- *
- * @param ap pointer to allocated memory
- * @param newsize required new memory size in bytes
- * @return pointer to allocated memory at least required size
- *	with original content
+ * @param a the arena
+ * @param n the number of blocks
+ * @param sizes the bytes to allocate for each block, or NULL if
+ *  each is nbytes
+ * @param nbytes the bytes to allocate for each block if sizes is NULL
+ * @param total the sum of the block sizes
+ * @param ptrs the location for the n allocated payloads
+ * @return true if the blocks were allocated
  */
-void* mm_realloc(void *ap, size_t newsize) {
-	// NULL ap acts as malloc for size newsize bytes
-	if (ap == NULL) {
-		return mm_malloc(newsize);
-	}
-
-	Header* bp = mm_block(ap);    // point to block header
-	if (newsize > 0) {
-		// return this ap if allocated block large enough
-		if (bp->s.size >= mm_units(newsize)) {
-			return ap;
-		}
-	}
+static bool mm_carve(Arena *a, size_t n, const size_t *sizes, size_t nbytes,
+                     size_t total, void **ptrs) {
+    Header *p = mm_find(a, total);
+    if (p == NULL) {
+        if (morecore(a, total) == NULL) {
+            return false;
+        }
+        p = mm_find(a, total);
+        assert(p != NULL);
+    }
 
-	// allocate new block
-	void *newap = mm_malloc(newsize);
-	if (newap == NULL) {
-		return NULL;
-	}
-	// copy old block to new block
-	size_t oldsize = mm_bytes(bp->s.size-1);
-	memcpy(newap, ap, (oldsize < newsize) ? oldsize : newsize);
-	mm_free(ap);
-	return newap;
+    mm_unlink(a, p);
+    size_t avail = mm_size(p);
+    size_t zero = p->size & MM_ZERO;
+    for (size_t i = 0; i < n; i++) {
+        size_t size = mm_blocksize((sizes != NULL) ? sizes[i] : nbytes);
+        avail -= size;
+        if (i == n - 1 && avail < MM_MIN_BLOCK) {
+            size += avail;
+            avail = 0;
+        }
+        mm_setAlloc(p, size);
+        a->stats.alloc_bytes += size - MM_OVERHEAD;
+        a->stats.alloc_blocks++;
+        ptrs[i] = mm_payload(p);
+        p = mm_after(p);
+    }
+    if (avail > 0) {
+        mm_setFree(p, avail);
+        p->size |= zero;
+        mm_link(a, p);
+    }
+    return true;
 }
 
 /**
- * Contiguously allocates enough space for count objects that are
- * size bytes of memory each and returns a pointer to the allocated
- * memory.  The allocated memory is filled with bytes of value zero.
+ * Size class of slab objects for a request of nbytes bytes.
  *
- * @param count the number of blocks to allocate
- * @param size the size of each element
- * @return pointer to allocated memory or NULL if not available.
+ * @param nbytes number of bytes
+ * @return the slab class of the request
  */
-void* mm_calloc(size_t count, size_t size) {
-	// multiply and check for overflow: not available
-	// in standard C and K&R version ignored overflow
-	size_t nbytes; // product
-	if (mul_of(count, size, &nbytes)) { // overflow if true
-		return NULL;
-	}
-
-	void* p = mm_malloc(nbytes);
-	if (p != NULL) {
-		memset(p, 0, nbytes);
-	}
-	return p;
+inline static size_t mm_slab_class(size_t nbytes) {
+    return (nbytes == 0) ? 0 : (nbytes - 1) / MM_SLAB_ALIGN;
 }
 
 /**
- * Request additional memory to be added to this process.
+ * Get the slab whose page contains an allocated payload.
  *
- * @param nu the number of Header units to be added
- * @return pointer to start additional memory added
+ * @param ap the allocated payload pointer
+ * @return the slab or NULL if ap is not a slab object
  */
-static Header *morecore(size_t nu) {
-	// nalloc based on page size
-	size_t nalloc = mem_pagesize()/sizeof(Header);
-
-    /* get at least NALLOC Header-chunks from the OS */
-    if (nu < nalloc) {
-        nu = nalloc;
-    }
-
-    size_t nbytes = mm_bytes(nu); // number of bytes
-    void* p = mem_sbrk(nbytes);
-    if (p == (char *) -1) {	// no space
+inline static Slab *mm_slab_of(void *ap) {
+    size_t page = (size_t)((char *)ap - (char *)mem_heap_lo()) >> pageshift;
+    if (page / 64 >= slabmap_len || !(MM_LOAD(&slabmap[page / 64]) & ((uint64_t)1 << (page % 64)))) {
         return NULL;
     }
+    // slab descriptor is at the page start
+    return (Slab *)((uintptr_t)ap & ~(((uintptr_t)1 << pageshift) - 1));
+}
 
-    Header* bp = (Header*)p;
-    // Need to set size for both header and footer
-    mm_setSize(bp, nu);
-    // add new space to the circular list
-    mm_free(bp+1);
-
-    return freep;
+/**
+ * Get the usable bytes of an allocated payload.
+ *
+ * @param ap the allocated payload pointer
+ * @return the object size of a slab object or the block payload size
+ */
+inline static size_t mm_usable(void *ap) {
+    Slab *sp = mm_slab_of(ap);
+    return (sp != NULL) ? sp->size : (MM_LOAD(&mm_block(ap)->size) & ~MM_FLAGS) - MM_OVERHEAD;
 }
 
+#ifdef MM_THREAD_SAFE
 /**
- * Print the free list (debugging only)
+ * Get the usable size of a free object on a cache or remote free
+ * list, kept in its second word.
  *
- * @msg the initial message to print
+ * @param ap the object
+ * @return the usable size recorded for the object
  */
-void visualize(const char* msg) {
-    fprintf(stderr, "\n--- Free list after \"%s\":\n", msg);
+inline static size_t mm_cachedSize(void *ap) {
+    return ((size_t *)ap)[1];
+}
 
-    if (freep == NULL) {                   /* does not exist */
-        fprintf(stderr, "    List is empty or not exist\n\n");
-        return;
-    }
+/**
+ * Record the usable size of a free object put on a cache or remote
+ * free list in its second word.
+ *
+ * @param ap the object
+ * @param usable the usable size of the object
+ */
+inline static void mm_setCachedSize(void *ap, size_t usable) {
+    ((size_t *)ap)[1] = usable;
+}
+#endif
+
+/**
+ * Create the slab map for the largest heap. The map never moves,
+ * so it can be read without the heap lock.
+ *
+ * @return true if the slab map exists
+ */
+static bool mm_slab_initmap(void) {
+    if (slabmap == NULL) {
+        pageshift = __builtin_ctzl(mem_pagesize());
+        size_t len = ((mem_maxheapsize() >> pageshift) + 63) / 64;
+        if ((slabmap = calloc(len, sizeof(uint64_t))) == NULL) {
+            return false;
+        }
+        slabmap_len = len;
+    }
+    return true;
+}
+
+/**
+ * Mark or unmark the page of a slab in the slab map.
+ *
+ * @param sp the slab
+ * @param isslab true to mark the page, false to unmark it
+ * @return true if the slab map covers the page
+ */
+static bool mm_slab_mark(Slab *sp, bool isslab) {
+    if (!mm_slab_initmap()) {
+        return false;
+    }
+    size_t page = (size_t)((char *)sp - (char *)mem_heap_lo()) >> pageshift;
+    if (isslab) {
+        MM_OR(&slabmap[page / 64], (uint64_t)1 << (page % 64));
+    } else {
+        MM_AND(&slabmap[page / 64], ~((uint64_t)1 << (page % 64)));
+    }
+    return true;
+}
+
+/**
+ * Link a slab into the head of the list of slabs with free objects.
+ *
+ * @param a the arena of the slab
+ * @param sp the slab
+ */
+inline static void mm_slab_link(Arena *a, Slab *sp) {
+    size_t cls = mm_slab_class(sp->size);
+    sp->prev = NULL;
+    sp->next = a->slabs[cls];
+    if (sp->next != NULL) {
+        sp->next->prev = sp;
+    }
+    a->slabs[cls] = sp;
+}
+
+/**
+ * Unlink a slab from the list of slabs with free objects.
+ *
+ * @param a the arena of the slab
+ * @param sp the slab
+ */
+inline static void mm_slab_unlink(Arena *a, Slab *sp) {
+    if (sp->prev != NULL) {
+        sp->prev->next = sp->next;
+    } else {
+        a->slabs[mm_slab_class(sp->size)] = sp->next;
+    }
+    if (sp->next != NULL) {
+        sp->next->prev = sp->prev;
+    }
+}
+
+/**
+ * Create a slab for objects of a size class in a new page-aligned,
+ * page-sized block, and link it into the list for the class.
+ *
+ * @param a the arena
+ * @param cls the slab class
+ * @return the new slab or NULL if not available
+ */
+static Slab *mm_slab_create(Arena *a, size_t cls) {
+    size_t pagesize = mem_pagesize();
+    Header *bp = mm_alloc_aligned(a, pagesize, pagesize);
+    if (bp == NULL) {
+        return NULL;
+    }
+    Slab *sp = mm_payload(bp);
+    if (!mm_slab_mark(sp, true)) {
+        mm_release(a, bp);
+        return NULL;
+    }
+
+    // objects follow the descriptor up to the end of the page payload
+    sp->size = (cls + 1) * MM_SLAB_ALIGN;
+    char *obj = (char *)sp + (sizeof(Slab) + MM_SLAB_ALIGN - 1) / MM_SLAB_ALIGN * MM_SLAB_ALIGN;
+    sp->nobjs = (size_t)((char *)sp + pagesize - MM_OVERHEAD - obj) / sp->size;
+    sp->nfree = sp->nobjs;
+    a->stats.free_bytes += sp->nobjs * sp->size;
+    a->stats.free_blocks += sp->nobjs;
+    sp->free = NULL;
+    for (size_t i = sp->nobjs; i-- > 0; ) {
+        void **op = (void **)(obj + i * sp->size);
+        *op = sp->free;
+        sp->free = op;
+    }
+    mm_slab_link(a, sp);
+    return sp;
+}
+
+/**
+ * Allocate an object of at most MM_SLAB_MAX bytes from a slab.
+ *
+ * @param a the arena
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated object or NULL if not available.
+ */
+static void *mm_slab_alloc(Arena *a, size_t nbytes) {
+    size_t cls = mm_slab_class(nbytes);
+    Slab *sp = a->slabs[cls];
+    if (sp == NULL && (sp = mm_slab_create(a, cls)) == NULL) {
+        return NULL;
+    }
+    void **op = sp->free;
+    sp->free = *op;
+    a->stats.free_bytes -= sp->size;
+    a->stats.free_blocks--;
+    if (--sp->nfree == 0) {
+        // full slabs are not on the list
+        mm_slab_unlink(a, sp);
+    }
+    return op;
+}
+
+/**
+ * Return a slab whose objects are all free to the free lists.
+ *
+ * @param a the arena of the slab
+ * @param sp the slab
+ */
+static void mm_slab_release(Arena *a, Slab *sp) {
+    a->stats.free_bytes -= sp->nobjs * sp->size;
+    a->stats.free_blocks -= sp->nobjs;
+    mm_slab_unlink(a, sp);
+    mm_slab_mark(sp, false);
+    mm_release(a, mm_block(sp));
+}
+
+/**
+ * Return an object to its slab. A slab whose objects are all free
+ * is returned to the free lists unless it is the only slab with
+ * free objects of its class.
+ *
+ * @param a the arena of the slab
+ * @param sp the slab of the object
+ * @param ap the object
+ */
+static void mm_slab_free(Arena *a, Slab *sp, void *ap) {
+    void **op = ap;
+    *op = sp->free;
+    sp->free = op;
+    a->stats.free_bytes += sp->size;
+    a->stats.free_blocks++;
+    if (sp->nfree++ == 0) {
+        mm_slab_link(a, sp);
+    } else if (sp->nfree == sp->nobjs && (sp->prev != NULL || sp->next != NULL)) {
+        mm_slab_release(a, sp);
+    }
+}
+
+#ifdef MM_THREAD_SAFE
+/**
+ * Free an object of an arena from a thread of another arena by
+ * pushing it onto the remote free list of the arena, without
+ * taking its lock.
+ *
+ * @param a the arena of the object
+ * @param ap the object
+ * @param usable the usable size of the object
+ */
+inline static void mm_remote_free(Arena *a, void *ap, size_t usable) {
+    void **op = ap;
+    mm_setCachedSize(op, usable);
+    MM_ADD(&a->remote_blocks, 1);
+    MM_ADD(&a->remote_bytes, usable);
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+    do {
+        *op = head;
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, op, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Free the objects on the remote free list of an arena, with the
+ * arena lock held.
+ *
+ * @param a the arena
+ */
+inline static void mm_remote_drain(Arena *a) {
+    if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    void **op = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    size_t nblocks = 0;
+    size_t nbytes = 0;
+    while (op != NULL) {
+        void **next = *op;
+        nblocks++;
+        nbytes += mm_cachedSize(op);
+        mm_central_free(a, op);
+        op = next;
+    }
+    MM_SUB(&a->remote_blocks, nblocks);
+    MM_SUB(&a->remote_bytes, nbytes);
+}
+#endif
+
+/**
+ * Allocate nbytes bytes from an arena, with the arena lock held.
+ *
+ * @param a the arena
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+static void *mm_central_malloc(Arena *a, size_t nbytes) {
+#ifdef MM_THREAD_SAFE
+    mm_remote_drain(a);
+#endif
+    // heap handles have no slabs, whose pages would outlive the heap in the slab map
+    if (MM_SLAB_MAX > 0 && nbytes <= MM_SLAB_MAX && a->region >= 0) {
+        void *ap = mm_slab_alloc(a, nbytes);
+        if (ap == NULL) {
+            errno = ENOMEM;
+        } else {
+            a->stats.alloc_bytes += mm_usable(ap);
+            a->stats.alloc_blocks++;
+        }
+        return ap;
+    }
+
+    if (debug) visualize("PRE-MALLOC");
+    // smallest block (+ header and footer words) needed to hold nbytes
+    if (nbytes > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t size = mm_blocksize(nbytes);
+    if (debug) fprintf(stderr, "size %zu\n", size);
+
+    Header *p = mm_find(a, size);
+    if (p == NULL) {
+        // nothing large enough - we need to allocate
+        if (morecore(a, size) == NULL) {
+            errno = ENOMEM;
+            return NULL;                /* none left */
+        }
+        p = mm_find(a, size);
+        assert(p != NULL);
+    }
+
+    if (debug) fprintf(stderr,"Found block %10p to allocate, size %zu \n", (void*) p, mm_size(p));
+    // the lower part stays zero, and the block allocated is zero for mm_calloc
+    size_t zero = p->size & MM_ZERO;
+    size_t rest = mm_size(p) - size;
+    if (rest >= MM_MIN_BLOCK) {
+        // split and allocate tail end
+        if (debug) fprintf(stderr,"Split \n");
+        if (mm_class(rest) == mm_class(mm_size(p))) {
+            // lower part keeps its place in the free list
+            a->stats.free_bytes -= size;
+            mm_setFree(p, rest);
+            p->size |= zero;
+        } else {
+            mm_unlink(a, p);
+            mm_setFree(p, rest);
+            p->size |= zero;
+            mm_link(a, p);
+        }
+        if (debug) fprintf(stderr,"First block in split size %zu\n", mm_size(p));
+        /* find the address to return */
+        p = mm_after(p);		 // address upper block to return
+    } else {
+        // free block exact size
+        if (debug) fprintf(stderr,"Exact fit \n");
+        mm_unlink(a, p);
+        size = mm_size(p);
+    }
+    mm_setAlloc(p, size);
+    p->size |= zero;
+    a->stats.alloc_bytes += size - MM_OVERHEAD;
+    a->stats.alloc_blocks++;
+    if (debug) visualize("POST-MALLOC");
+    return mm_payload(p);
+}
+
+/**
+ * Coalesce a block with its free neighbors and link the
+ * result into the free list for its size.
+ *
+ * @param a the arena of the block
+ * @param bp the block to release
+ * @return the coalesced free block
+ */
+static Header *mm_release(Arena *a, Header *bp) {
+    size_t size = mm_size(bp);
+    Header *p = mm_after(bp);
+    if (mm_isFree(p)) {
+		/* coalesce if adjacent to upper neighbor
+         *  unlink the upper block from free list and coalese
+         */
+        if (debug) fprintf(stderr,"Coalese upper \n");
+        mm_unlink(a, p);
+        size += mm_size(p);
+    }
+
+    if (mm_isPrevFree(bp)) {
+        /* coalesce if adjacent to lower block
+         *  unlink the lower block from free list and coalese
+         */
+        if (debug) fprintf(stderr,"Coalese lower \n");
+        p = mm_before(bp);
+        mm_unlink(a, p);
+        size += mm_size(p);
+        // reset bp to where p is
+        bp = p;
+    }
+    /* link bp into the free list for its size,
+     * bp could have been coaesced with upper/lower block already
+     */
+    mm_setFree(bp, size);
+    mm_link(a, bp);
+    return bp;
+}
+
+/**
+ * Clear memory of the heap, returning its whole pages to the system.
+ *
+ * @param lo the start of the memory
+ * @param hi the end of the memory
+ */
+static void mm_purge(char *lo, char *hi) {
+    size_t pagesize = mem_pagesize();
+    char *plo = (char *)(((uintptr_t)lo + pagesize - 1) & ~(uintptr_t)(pagesize - 1));
+    char *phi = (char *)((uintptr_t)hi & ~(uintptr_t)(pagesize - 1));
+    if (phi <= plo) {
+        memset(lo, 0, hi - lo);
+        return;
+    }
+    memset(lo, 0, plo - lo);
+    memset(phi, 0, hi - phi);
+    mem_purge(plo, phi - plo);
+}
+
+/**
+ * Release a block to an arena and, if the free block that results
+ * has at least MM_PURGE_MIN bytes, return its whole pages to the
+ * system, clearing the rest of its payload but for its free list
+ * links and footer so that the block is MM_ZERO. If the blocks it
+ * coalesced with are MM_ZERO, only the released block and the
+ * boundary words between them need clearing.
+ *
+ * @param a the arena of the block
+ * @param bp the block to release
+ * @return the coalesced free block
+ */
+static Header *mm_release_purge(Arena *a, Header *bp) {
+    char *lo = (char *)(bp + 1);
+    char *hi = (char *)bp + mm_size(bp) - MM_WSIZE;
+    bool zero = true;
+    Header *p = mm_after(bp);
+    if (mm_isFree(p)) {
+        // header and links of the block after
+        hi = (char *)(p + 1);
+        zero = (p->size & MM_ZERO) != 0;
+    }
+    if (mm_isPrevFree(bp)) {
+        // footer of the block before
+        lo = (char *)bp - MM_WSIZE;
+        zero = zero && (mm_before(bp)->size & MM_ZERO) != 0;
+    }
+    bp = mm_release(a, bp);
+    if (MM_PURGE_MIN == 0 || mm_size(bp) < MM_PURGE_MIN) {
+        return bp;
+    }
+    if (!zero) {
+        lo = (char *)(bp + 1);
+        hi = (char *)mm_footer(bp);
+    }
+    mm_purge(lo, hi);
+    bp->size |= MM_ZERO;
+    return bp;
+}
+
+/**
+ * Return the chunk of a heap handle to the arenas if a free block
+ * spans all of it, unless it is the newest chunk.
+ *
+ * @param a the arena of the heap handle
+ * @param bp the free block
+ */
+static void mm_heap_trim(Arena *a, Header *bp) {
+    Header *ep = mm_after(bp);
+    // only the epilogue header has size 0
+    if (mm_size(ep) != 0) {
+        return;
+    }
+    Chunk *cp = *(Chunk **)(ep + 1);
+    if ((char *)bp != (char *)cp + 3 * MM_ALIGN - MM_WSIZE || cp == a->chunks) {
+        return;
+    }
+    mm_unlink(a, bp);
+    cp->prev->next = cp->next;
+    if (cp->next != NULL) {
+        cp->next->prev = cp->prev;
+    }
+    a->stats.heap_size -= mm_usable(cp);
+    mm_free(cp);
+}
+
+/**
+ * Return an allocation to the arena that owns it, with the arena
+ * lock held.
+ *
+ * @param a the arena of the allocation
+ * @param ap the memory to free
+ */
+static void mm_central_free(Arena *a, void *ap) {
+    if (debug) visualize("PRE-FREE");
+	// ignore null pointer
+    if (ap == NULL) {
+        return;
+    }
+    a->stats.alloc_blocks--;
+
+    // objects of slab pages go back to their slab
+    Slab *sp = mm_slab_of(ap);
+    if (sp != NULL) {
+        a->stats.alloc_bytes -= sp->size;
+        mm_slab_free(a, sp, ap);
+        return;
+    }
+
+    Header *bp = mm_block(ap);   /* point to block header */
+    a->stats.alloc_bytes -= mm_size(bp) - MM_OVERHEAD;
+    // validate size word of header block
+    assert(!mm_isFree(bp) && mm_size(bp) >= MM_MIN_BLOCK && mm_size(bp) <= mm_arena_size(a));
+    if (a->region < 0) {
+        mm_heap_trim(a, mm_release(a, bp));
+    } else {
+        mm_release_purge(a, bp);
+    }
+    if (debug) visualize("POST-FREE");
+}
+
+/**
+ * Deallocate the memory allocations of an arena pointed to by the
+ * ptrs in increasing address order, with the arena lock held. Each
+ * run of adjacent blocks is released as one block.
+ *
+ * @param a the arena
+ * @param ptrs the allocations in increasing address order
+ * @param n the number of allocations
+ */
+static void mm_central_free_sorted(Arena *a, void **ptrs, size_t n) {
+    for (size_t i = 0; i < n; ) {
+        void *ap = ptrs[i++];
+        if (mm_slab_of(ap) != NULL) {
+            mm_central_free(a, ap);
+            continue;
+        }
+        Header *bp = mm_block(ap);
+        assert(!mm_isFree(bp) && mm_size(bp) >= MM_MIN_BLOCK && mm_size(bp) <= mm_arena_size(a));
+        size_t size = mm_size(bp);
+        a->stats.alloc_bytes -= size - MM_OVERHEAD;
+        a->stats.alloc_blocks--;
+        // blocks of the batch that follow the run join it
+        while (i < n && mm_block(ptrs[i]) == (Header *)((char *)bp + size)
+               && mm_slab_of(ptrs[i]) == NULL) {
+            Header *np = mm_block(ptrs[i++]);
+            a->stats.alloc_bytes -= mm_size(np) - MM_OVERHEAD;
+            a->stats.alloc_blocks--;
+            size += mm_size(np);
+        }
+        mm_setAlloc(bp, size);
+        if (a->region < 0) {
+            mm_heap_trim(a, mm_release(a, bp));
+        } else {
+            mm_release_purge(a, bp);
+        }
+    }
+}
+
+/**
+ * Shrink an allocated block in place to size bytes, releasing
+ * the tail end if it is large enough to be a block of its own.
+ *
+ * @param a the arena of the block
+ * @param bp the allocated block
+ * @param size the required block size in bytes
+ */
+static void mm_shrink(Arena *a, Header *bp, size_t size) {
+    size_t rest = mm_size(bp) - size;
+    if (rest >= MM_MIN_BLOCK) {
+        if (debug) fprintf(stderr,"Shrink \n");
+        mm_setAlloc(bp, size);
+        // tail end coalesces with a free block after it
+        Header *p = mm_after(bp);
+        p->size = rest | MM_ALLOC;
+        mm_release(a, p);
+    }
+}
+
+/**
+ * Grow an allocated block in place to at least size bytes by
+ * absorbing the free block after it, returning any remainder
+ * to the free lists.
+ *
+ * @param a the arena of the block
+ * @param bp the allocated block
+ * @param size the required block size in bytes
+ * @return true if the block was grown
+ */
+static bool mm_grow(Arena *a, Header *bp, size_t size) {
+    Header *p = mm_after(bp);
+    if (!mm_isFree(p) || mm_size(bp) + mm_size(p) < size) {
+        return false;
+    }
+
+    if (debug) fprintf(stderr,"Grow into upper \n");
+    mm_unlink(a, p);
+    mm_setAlloc(bp, mm_size(bp) + mm_size(p));
+    mm_shrink(a, bp, size);
+    return true;
+}
+
+/**
+ * Extend the heap of an arena by incr bytes, counting the call in
+ * the statistics of the arena and raising the peak size of the heap
+ * of all the arenas.
+ *
+ * @param a the arena
+ * @param incr the number of bytes to add
+ * @return start of the new area, or (void *)-1 if not available
+ */
+static void *mm_mem_sbrk(Arena *a, size_t incr) {
+    a->stats.sbrk_calls++;
+    void *p = mem_region_sbrk(a->region, incr);
+    if (p != (void *)-1) {
+        size_t total = MM_ADD(&heap_total, incr);
+        size_t peak = MM_LOAD(&heap_peak);
+        while (total > peak && !MM_CAS(&heap_peak, &peak, total)) {
+        }
+    }
+    return p;
+}
+
+/**
+ * Grow the last block of the heap in place to size bytes by
+ * extending the heap by the bytes missing, absorbing a free block
+ * between the block and the end of the heap.
+ *
+ * @param a the arena of the block
+ * @param bp the allocated block
+ * @param size the required block size in bytes
+ * @return true if the block was grown
+ */
+static bool mm_extend(Arena *a, Header *bp, size_t size) {
+    // chunks of heap handles have a fixed size
+    if (a->region < 0) {
+        return false;
+    }
+    Header *p = mm_after(bp);
+    size_t have = mm_size(bp);
+    if (mm_isFree(p)) {
+        have += mm_size(p);
+        p = mm_after(p);
+    }
+    // only the epilogue header has size 0
+    if (mm_size(p) != 0) {
+        return false;
+    }
+    if (mm_mem_sbrk(a, size - have) == (void *)-1) {	// no space
+        return false;
+    }
+
+    if (debug) fprintf(stderr,"Extend heap \n");
+    p = mm_after(bp);
+    if (mm_isFree(p)) {
+        mm_unlink(a, p);
+    }
+    ((Header *)((char *)bp + size))->size = MM_ALLOC;
+    mm_setAlloc(bp, size);
+    return true;
+}
+
+/**
+ * Change the size of an allocation in the arena that owns it, with
+ * the arena lock held. The allocation is shrunk in place by releasing
+ * the tail end of its block, and enlarged in place when the block
+ * after it is free and large enough or the block is the last in the
+ * heap of the arena.
+ *
+ * @param a the arena of the allocation
+ * @param ap pointer to allocated memory
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+static void *mm_central_realloc(Arena *a, void *ap, size_t newsize) {
+	// usable bytes of the slab object or block
+	Slab *sp = mm_slab_of(ap);
+	size_t oldsize = mm_usable(ap);
+	if (newsize > 0) {
+		// return this ap if allocated object or block large enough,
+		// releasing the unused tail end of a block
+		if (oldsize >= newsize) {
+			if (sp == NULL) {
+				mm_shrink(a, mm_block(ap), mm_blocksize(newsize));
+				a->stats.alloc_bytes -= oldsize - mm_usable(ap);
+			}
+			return ap;
+		}
+		// grow block in place into a free block after it
+		// or by extending the heap if it is the last block
+		if (sp == NULL && newsize <= SIZE_MAX / 2) {
+			Header *bp = mm_block(ap);
+			size_t size = mm_blocksize(newsize);
+			if (mm_grow(a, bp, size) || mm_extend(a, bp, size)) {
+				a->stats.alloc_bytes += mm_usable(ap) - oldsize;
+				return ap;
+			}
+		}
+	}
+
+	// allocate new block
+	void *newap = mm_central_malloc(a, newsize);
+	if (newap == NULL) {
+		return NULL;
+	}
+	// copy old block to new block
+	memcpy(newap, ap, (oldsize < newsize) ? oldsize : newsize);
+	mm_central_free(a, ap);
+	return newap;
+}
+
+/**
+ * Allocate nbytes bytes from the arena of the calling thread, or
+ * from the other arenas in turn if its region is full.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+static void *mm_arena_malloc(size_t nbytes) {
+    Arena *a = mm_arena();
+    for (int n = 0; n < narenas; n++) {
+        MM_LOCK(a);
+        void *ap = mm_central_malloc(a, nbytes);
+        MM_UNLOCK(a);
+        if (ap != NULL) {
+            return ap;
+        }
+        a = &arenas[(a - arenas + 1) % narenas];
+    }
+    return NULL;
+}
+
+#ifdef MM_THREAD_SAFE
+/**
+ * Return up to n objects of a class of a thread cache to the arenas
+ * that own them: to the arena of the thread under its lock, and to
+ * the remote free lists of other arenas.
+ *
+ * @param tc the thread cache
+ * @param cls the size class
+ * @param n the number of objects to return
+ */
+static void mm_tcache_flush(TCache *tc, size_t cls, unsigned n) {
+    Arena *own = mm_arena();
+    Arena *locked = NULL;
+    while (n-- > 0 && tc->bins[cls] != NULL) {
+        void **op = tc->bins[cls];
+        tc->bins[cls] = *op;
+        tc->count[cls]--;
+        tc->nobjs--;
+        tc->nbytes -= mm_cachedSize(op);
+        Arena *a = mm_arena_of(op);
+        if (a != own) {
+            mm_remote_free(a, op, mm_cachedSize(op));
+            continue;
+        }
+        if (a != locked) {
+            if (locked != NULL) {
+                MM_UNLOCK(locked);
+            }
+            MM_LOCK(a);
+            locked = a;
+        }
+        mm_central_free(a, op);
+    }
+    if (locked != NULL) {
+        MM_UNLOCK(locked);
+    }
+}
+
+/**
+ * Return all objects of a thread cache to their arenas unless the
+ * heap was reset since they were cached.
+ *
+ * @param arg the thread cache
+ */
+static void mm_tcache_flushall(void *arg) {
+    TCache *tc = arg;
+    if (tc->generation == generation) {
+        for (size_t cls = 0; cls < MM_TCACHE_CLASSES; cls++) {
+            mm_tcache_flush(tc, cls, tc->count[cls]);
+        }
+    }
+}
+
+/**
+ * Create the key that flushes thread caches on thread exit.
+ */
+static void mm_tcache_key(void) {
+    pthread_key_create(&tcache_key, mm_tcache_flushall);
+}
+
+/**
+ * Get the cache of this thread, emptied if the heap was reset
+ * since its objects were cached.
+ *
+ * @return the thread cache
+ */
+inline static TCache *mm_tcache(void) {
+    TCache *tc = &tcache;
+    if (tc->generation != generation) {
+        if (tc->generation == 0) {
+            // first use: flush the cache when the thread exits
+            pthread_once(&tcache_once, mm_tcache_key);
+            pthread_setspecific(tcache_key, tc);
+        }
+        memset(tc->bins, 0, sizeof(tc->bins));
+        memset(tc->count, 0, sizeof(tc->count));
+        tc->nobjs = 0;
+        tc->nbytes = 0;
+        tc->generation = generation;
+    }
+    return tc;
+}
+
+/**
+ * Allocate an object of at most MM_TCACHE_MAX bytes from the cache
+ * of this thread, refilling its list from the arena of the thread
+ * if empty.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+static void *mm_tcache_alloc(size_t nbytes) {
+    TCache *tc = mm_tcache();
+    size_t cls = (nbytes == 0) ? 0 : (nbytes - 1) / MM_ALIGN;
+    if (tc->bins[cls] == NULL) {
+        Arena *a = mm_arena();
+        MM_LOCK(a);
+        for (unsigned n = 0; n < MM_TCACHE_BATCH; n++) {
+            void **op = mm_central_malloc(a, (cls + 1) * MM_ALIGN);
+            if (op == NULL) {
+                break;
+            }
+            mm_setCachedSize(op, mm_usable(op));
+            *op = tc->bins[cls];
+            tc->bins[cls] = op;
+            tc->count[cls]++;
+            tc->nobjs++;
+            tc->nbytes += mm_cachedSize(op);
+        }
+        MM_UNLOCK(a);
+        if (tc->bins[cls] == NULL) {
+            // region of the arena is full
+            return mm_arena_malloc(nbytes);
+        }
+    }
+    void **op = tc->bins[cls];
+    tc->bins[cls] = *op;
+    tc->count[cls]--;
+    tc->nobjs--;
+    tc->nbytes -= mm_cachedSize(op);
+    return op;
+}
+
+/**
+ * Return an object to the cache of this thread, flushing part of
+ * its list to the heap if full.
+ *
+ * @param ap the allocated payload pointer
+ * @param usable the usable size of the object, or a multiple of
+ *  MM_ALIGN bytes no larger
+ * @return true if the object was cached
+ */
+static bool mm_tcache_free(void *ap, size_t usable) {
+    // the usable size of a cached object fits all requests of its class
+    size_t cls = usable / MM_ALIGN - 1;
+    if (cls >= MM_TCACHE_CLASSES) {
+        return false;
+    }
+    TCache *tc = mm_tcache();
+    void **op = ap;
+    mm_setCachedSize(op, usable);
+    *op = tc->bins[cls];
+    tc->bins[cls] = op;
+    tc->nobjs++;
+    tc->nbytes += usable;
+    if (++tc->count[cls] > 2 * MM_TCACHE_BATCH) {
+        mm_tcache_flush(tc, cls, MM_TCACHE_BATCH);
+    }
+    return true;
+}
+#endif
+
+#ifdef MM_RSEQ
+/**
+ * Start of a restartable sequence: its rseq_cs descriptor (start,
+ * length up to the commit and abort handler) and the store of the
+ * descriptor into the rseq area that arms it.
+ */
+#define MM_RSEQ_START \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3:\n\t" \
+    ".long 0x0, 0x0\n\t" \
+    ".quad 1f, (2f - 1f), 4f\n\t" \
+    ".popsection\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t" \
+    "1:\n\t" \
+    "cmpl %[cpu], %[cpu_id]\n\t" \
+    "jnz %l[abort]\n\t"
+
+/**
+ * End of a restartable sequence after its commit store, and its
+ * abort handler preceded by the RSEQ_SIG signature.
+ */
+#define MM_RSEQ_END \
+    "2:\n\t" \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long 0x53053053\n\t" \
+    "4:\n\t" \
+    "jmp %l[abort]\n\t" \
+    ".popsection\n\t"
+
+/**
+ * Pop an object of a class from the cache of a CPU.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param cpu the CPU the thread runs on
+ * @param cls the size class
+ * @param opp the popped object
+ * @return 1 if an object was popped, 0 if the list is empty,
+ *  or -1 if the thread was preempted or migrated
+ */
+static int mm_pcpu_pop(struct rseq *rs, unsigned cpu, size_t cls, void **opp) {
+    CpuCache *cc = &cpucaches[cpu];
+    __asm__ __volatile__ goto (
+        MM_RSEQ_START
+        "movq %[count], %%rcx\n\t"
+        "testq %%rcx, %%rcx\n\t"
+        "jz %l[empty]\n\t"
+        "movq -8(%[slots], %%rcx, 8), %%rdx\n\t"
+        "movq %%rdx, (%[opp])\n\t"
+        "decq %%rcx\n\t"
+        // commit
+        "movq %%rcx, %[count]\n\t"
+        MM_RSEQ_END
+        :
+        : [rseq_cs] "m" (rs->rseq_cs), [cpu_id] "m" (rs->cpu_id), [cpu] "r" (cpu),
+          [count] "m" (cc->count[cls]), [slots] "r" (cc->slots[cls]), [opp] "r" (opp)
+        : "memory", "cc", "rax", "rcx", "rdx"
+        : abort, empty);
+    return 1;
+abort:
+    return -1;
+empty:
+    return 0;
+}
+
+/**
+ * Push an object of a class onto the cache of a CPU.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param cpu the CPU the thread runs on
+ * @param cls the size class
+ * @param op the object
+ * @return 1 if the object was pushed, 0 if the list is full,
+ *  or -1 if the thread was preempted or migrated
+ */
+static int mm_pcpu_push(struct rseq *rs, unsigned cpu, size_t cls, void *op) {
+    CpuCache *cc = &cpucaches[cpu];
+    __asm__ __volatile__ goto (
+        MM_RSEQ_START
+        "movq %[count], %%rcx\n\t"
+        "cmpq %[max], %%rcx\n\t"
+        "jae %l[full]\n\t"
+        "movq %[op], (%[slots], %%rcx, 8)\n\t"
+        "incq %%rcx\n\t"
+        // commit
+        "movq %%rcx, %[count]\n\t"
+        MM_RSEQ_END
+        :
+        : [rseq_cs] "m" (rs->rseq_cs), [cpu_id] "m" (rs->cpu_id), [cpu] "r" (cpu),
+          [count] "m" (cc->count[cls]), [slots] "r" (cc->slots[cls]), [op] "r" (op),
+          [max] "i" (MM_PCPU_SLOTS)
+        : "memory", "cc", "rax", "rcx"
+        : abort, full);
+    return 1;
+abort:
+    return -1;
+full:
+    return 0;
+}
+
+/**
+ * Add to the byte count of the cache of a CPU. Objects pushed on
+ * one CPU may be counted on another, so only the sum over all CPUs
+ * is the usable bytes of the cached objects.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param cpu the CPU the thread runs on
+ * @param incr the bytes to add, modulo SIZE_MAX + 1
+ * @return 0 if added, or -1 if the thread was preempted or migrated
+ */
+static int mm_pcpu_add(struct rseq *rs, unsigned cpu, size_t incr) {
+    CpuCache *cc = &cpucaches[cpu];
+    __asm__ __volatile__ goto (
+        MM_RSEQ_START
+        // commit
+        "addq %[incr], %[nbytes]\n\t"
+        MM_RSEQ_END
+        :
+        : [rseq_cs] "m" (rs->rseq_cs), [cpu_id] "m" (rs->cpu_id), [cpu] "r" (cpu),
+          [nbytes] "m" (cc->nbytes), [incr] "r" (incr)
+        : "memory", "cc", "rax"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+/**
+ * Add to the byte count of the cache of the current CPU, retrying
+ * if the thread was preempted or migrated.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param incr the bytes to add, modulo SIZE_MAX + 1
+ */
+static void mm_pcpu_count(struct rseq *rs, size_t incr) {
+    while (mm_pcpu_add(rs, MM_LOAD(&rs->cpu_id_start), incr) < 0) {
+    }
+}
+
+/**
+ * Pop an object of a class from the cache of the current CPU,
+ * retrying if the thread was preempted or migrated, and count it
+ * out of the cache.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param cls the size class
+ * @return the object or NULL if the list is empty
+ */
+static void *mm_pcpu_get(struct rseq *rs, size_t cls) {
+    void *op = NULL;
+    int res;
+    do {
+        unsigned cpu = MM_LOAD(&rs->cpu_id_start);
+        res = mm_pcpu_pop(rs, cpu, cls, &op);
+    } while (res < 0);
+    if (res == 0) {
+        return NULL;
+    }
+    mm_pcpu_count(rs, -mm_cachedSize(op));
+    return op;
+}
+
+/**
+ * Push an object of a class onto the cache of the current CPU,
+ * retrying if the thread was preempted or migrated, and count it
+ * into the cache.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param cls the size class
+ * @param op the object, with its usable size recorded
+ * @return true if the object was pushed, false if the list is full
+ */
+static bool mm_pcpu_put(struct rseq *rs, size_t cls, void *op) {
+    // another thread may take the object once it is pushed
+    size_t usable = mm_cachedSize(op);
+    int res;
+    do {
+        unsigned cpu = MM_LOAD(&rs->cpu_id_start);
+        res = mm_pcpu_push(rs, cpu, cls, op);
+    } while (res < 0);
+    if (res == 0) {
+        return false;
+    }
+    mm_pcpu_count(rs, usable);
+    return true;
+}
+
+/**
+ * Return objects to the arenas that own them: to the arena of the
+ * CPU under its lock, and to the remote free lists of other arenas.
+ *
+ * @param ops the objects
+ * @param n the number of objects
+ */
+static void mm_pcpu_flush(void **ops, unsigned n) {
+    Arena *own = mm_arena();
+    Arena *locked = NULL;
+    for (unsigned i = 0; i < n; i++) {
+        Arena *a = mm_arena_of(ops[i]);
+        if (a != own) {
+            mm_remote_free(a, ops[i], mm_cachedSize(ops[i]));
+            continue;
+        }
+        if (a != locked) {
+            if (locked != NULL) {
+                MM_UNLOCK(locked);
+            }
+            MM_LOCK(a);
+            locked = a;
+        }
+        mm_central_free(a, ops[i]);
+    }
+    if (locked != NULL) {
+        MM_UNLOCK(locked);
+    }
+}
+
+/**
+ * Allocate an object of at most MM_TCACHE_MAX bytes from the cache
+ * of the current CPU, refilling its list from the arena of the CPU
+ * if empty.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+static void *mm_pcpu_alloc(struct rseq *rs, size_t nbytes) {
+    size_t cls = (nbytes == 0) ? 0 : (nbytes - 1) / MM_ALIGN;
+    void *op = mm_pcpu_get(rs, cls);
+    if (op != NULL) {
+        return op;
+    }
+
+    // keep one object of a batch and cache the others
+    void *batch[MM_TCACHE_BATCH];
+    unsigned n = 0;
+    Arena *a = mm_arena();
+    MM_LOCK(a);
+    while (n < MM_TCACHE_BATCH
+           && (batch[n] = mm_central_malloc(a, (cls + 1) * MM_ALIGN)) != NULL) {
+        n++;
+    }
+    MM_UNLOCK(a);
+    if (n == 0) {
+        // region of the arena is full
+        return mm_arena_malloc(nbytes);
+    }
+    for (unsigned k = 1; k < n; k++) {
+        mm_setCachedSize(batch[k], mm_usable(batch[k]));
+    }
+    unsigned i = 1;
+    while (i < n && mm_pcpu_put(rs, cls, batch[i])) {
+        i++;
+    }
+    // the list was filled meanwhile by other threads
+    mm_pcpu_flush(&batch[i], n - i);
+    return batch[0];
+}
+
+/**
+ * Return an object to the cache of the current CPU, flushing part
+ * of its list to the arenas if full.
+ *
+ * @param rs the rseq area of the calling thread
+ * @param ap the allocated payload pointer
+ * @param usable the usable size of the object, or a multiple of
+ *  MM_ALIGN bytes no larger
+ * @return true if the object was cached
+ */
+static bool mm_pcpu_free(struct rseq *rs, void *ap, size_t usable) {
+    // the usable size of a cached object fits all requests of its class
+    size_t cls = usable / MM_ALIGN - 1;
+    if (cls >= MM_TCACHE_CLASSES) {
+        return false;
+    }
+    mm_setCachedSize(ap, usable);
+    if (!mm_pcpu_put(rs, cls, ap)) {
+        void *batch[MM_TCACHE_BATCH + 1];
+        unsigned n = 0;
+        while (n < MM_TCACHE_BATCH && (batch[n] = mm_pcpu_get(rs, cls)) != NULL) {
+            n++;
+        }
+        batch[n++] = ap;
+        mm_pcpu_flush(batch, n);
+    }
+    return true;
+}
+
+/**
+ * Return all objects of the cache of the current CPU to the arenas
+ * that own them.
+ *
+ * @param rs the rseq area of the calling thread
+ */
+static void mm_pcpu_flushall(struct rseq *rs) {
+    for (size_t cls = 0; cls < MM_TCACHE_CLASSES; cls++) {
+        void *batch[MM_PCPU_SLOTS];
+        unsigned n = 0;
+        while (n < MM_PCPU_SLOTS && (batch[n] = mm_pcpu_get(rs, cls)) != NULL) {
+            n++;
+        }
+        mm_pcpu_flush(batch, n);
+    }
+}
+#endif
+
+/**
+ * Allocates size bytes of memory and returns a pointer to the
+ * allocated memory, or NULL if request storage cannot be allocated.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc(size_t nbytes) {
+#ifdef MM_THREAD_SAFE
+    if (nbytes <= MM_TCACHE_MAX) {
+#ifdef MM_RSEQ
+        struct rseq *rs = mm_rseq();
+        if (rs != NULL) {
+            return mm_pcpu_alloc(rs, nbytes);
+        }
+#endif
+        return mm_tcache_alloc(nbytes);
+    }
+#endif
+    return mm_arena_malloc(nbytes);
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap, which is
+ * not NULL, to the cache of the CPU or thread if small enough, or
+ * else to its arena.
+ *
+ * @param ap the memory to free
+ * @param usable the usable size of the object, a multiple of
+ *  MM_ALIGN bytes no larger, or 0 if not known
+ */
+static void mm_free_object(void *ap, size_t usable) {
+#ifdef MM_THREAD_SAFE
+    if (usable == 0) {
+        usable = mm_usable(ap);
+    }
+#ifdef MM_RSEQ
+    struct rseq *rs = mm_rseq();
+    if (rs != NULL && mm_pcpu_free(rs, ap, usable)) {
+        return;
+    }
+#endif
+    if (mm_tcache_free(ap, usable)) {
+        return;
+    }
+#else
+    (void)usable;
+#endif
+    Arena *a = mm_arena_of(ap);
+#ifdef MM_THREAD_SAFE
+    if (a != mm_arena()) {
+        // freed by a thread of another arena
+        mm_remote_free(a, ap, usable);
+        return;
+    }
+#endif
+    MM_LOCK(a);
+    mm_central_free(a, ap);
+    MM_UNLOCK(a);
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ */
+void mm_free(void *ap) {
+    if (ap != NULL) {
+        mm_free_object(ap, 0);
+    }
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap, whose size
+ * the caller knows: the size requested for it, or at most its
+ * usable size. A size in whole MM_ALIGN units is the size class
+ * of a cached object, so the object is cached without reading its
+ * block header. Define MM_CHECK_FREE_SIZE to check the size.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ * @param nbytes the size of the allocation in bytes
+ */
+void mm_free_sized(void *ap, size_t nbytes) {
+    if (ap == NULL) {
+        return;
+    }
+#ifdef MM_CHECK_FREE_SIZE
+    assert(nbytes <= mm_usable(ap));
+#endif
+    mm_free_object(ap, ((nbytes & MM_FLAGS) == 0) ? nbytes : 0);
+}
+
+/**
+ * Tries to change the size of the allocation pointed to by ap
+ * to size, and returns ap.
+ *
+ * The allocation is shrunk in place by releasing the tail end of
+ * its block, and enlarged in place when the block after it is
+ * free and large enough or the block is the last in the heap.
+ * If there is not enough room to enlarge the memory allocation
+ * pointed to by ap, realloc() creates a new allocation, copies
+ * as much of the old data pointed to by ptr as will fit to the
+ * new allocation, frees the old allocation, and returns a pointer
+ * to the allocated memory.
+ *
+ * If ap is NULL, realloc() is identical to a call to malloc()
+ * for size bytes.  If size is zero and ptr is not NULL, a minimum
+ * sized object is allocated and the original object is freed.
+ *
+ * @param ap pointer to allocated memory
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void* mm_realloc(void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_malloc(newsize);
+	}
+
+    Arena *a = mm_arena_of(ap);
+    MM_LOCK(a);
+    void *newap = mm_central_realloc(a, ap, newsize);
+    MM_UNLOCK(a);
+    if (newap == NULL && narenas > 1) {
+        // region of the arena is full: move to another arena
+        newap = mm_arena_malloc(newsize);
+        if (newap != NULL) {
+            size_t oldsize = mm_usable(ap);
+            memcpy(newap, ap, (oldsize < newsize) ? oldsize : newsize);
+            mm_free(ap);
+        }
+    }
+    return newap;
+}
+
+/**
+ * Contiguously allocates enough space for count objects that are
+ * size bytes of memory each and returns a pointer to the allocated
+ * memory.  The allocated memory is filled with bytes of value zero.
+ *
+ * @param count the number of blocks to allocate
+ * @param size the size of each element
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void* mm_calloc(size_t count, size_t size) {
+	// multiply and check for overflow: not available
+	// in standard C and K&R version ignored overflow
+	size_t nbytes; // product
+	if (mul_of(count, size, &nbytes)) { // overflow if true
+		return NULL;
+	}
+
+	void* p = mm_malloc(nbytes);
+	if (p == NULL) {
+		return NULL;
+	}
+#ifdef MM_THREAD_SAFE
+	bool block = nbytes > MM_SLAB_MAX && nbytes > MM_TCACHE_MAX;
+#else
+	bool block = nbytes > MM_SLAB_MAX;
+#endif
+	if (block) {
+		// blocks of larger requests come from the free lists, and a
+		// block carved from memory fresh from mem_sbrk is already zero
+		Header *bp = mm_block(p);
+		size_t size = MM_LOAD(&bp->size);
+		if (size & MM_ZERO) {
+			MM_AND(&bp->size, ~MM_ZERO);
+			// only the free list links and footer were written
+			memset(p, 0, sizeof(Header) - MM_WSIZE);
+			*(size_t *)((char *)bp + (size & ~MM_FLAGS) - MM_WSIZE) = 0;
+			return p;
+		}
+	}
+	memset(p, 0, nbytes);
+	return p;
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align.
+ * The block is carved out of a free block whose leading and
+ * trailing slack are returned to the free lists, so the memory
+ * is released by mm_free() and resized by mm_realloc() like any
+ * other; a moving mm_realloc() does not keep the alignment.
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_memalign(size_t align, size_t nbytes) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= MM_ALIGN) {
+        return mm_malloc(nbytes);
+    }
+    if (nbytes > SIZE_MAX / 4 || align > SIZE_MAX / 4) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t size = mm_blocksize(nbytes);
+    Arena *a = mm_arena();
+    for (int n = 0; n < narenas; n++) {
+        MM_LOCK(a);
+#ifdef MM_THREAD_SAFE
+        mm_remote_drain(a);
+#endif
+        Header *bp = mm_alloc_aligned(a, size, align);
+        if (bp != NULL) {
+            a->stats.alloc_bytes += mm_size(bp) - MM_OVERHEAD;
+            a->stats.alloc_blocks++;
+        }
+        MM_UNLOCK(a);
+        if (bp != NULL) {
+            return mm_payload(bp);
+        }
+        a = &arenas[(a - arenas + 1) % narenas];
+    }
+    errno = ENOMEM;
+    return NULL;
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as C11 aligned_alloc().
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_aligned_alloc(size_t align, size_t nbytes) {
+    return mm_memalign(align, nbytes);
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as POSIX posix_memalign(). Unlike the other allocation
+ * functions, errno is not set.
+ *
+ * @param pp the location for the allocated memory
+ * @param align the alignment in bytes, a power of two multiple
+ *  of sizeof(void *)
+ * @param nbytes the number of bytes to allocate
+ * @return 0, EINVAL if align is not valid, or ENOMEM if not available
+ */
+int mm_posix_memalign(void **pp, size_t align, size_t nbytes) {
+    if (align < sizeof(void *) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    int err = errno;
+    void *ap = mm_memalign(align, nbytes);
+    errno = err;
+    if (ap == NULL) {
+        return ENOMEM;
+    }
+    *pp = ap;
+    return 0;
+}
+
+/**
+ * Get the number of bytes usable in the memory allocation pointed
+ * to by ap, at least the number requested for it.
+ *
+ * @param ap pointer to allocated memory, or NULL
+ * @return the usable size in bytes, or 0 if ap is NULL
+ */
+size_t mm_malloc_usable_size(void *ap) {
+    if (ap == NULL) {
+        return 0;
+    }
+    return mm_usable(ap);
+}
+
+/**
+ * Allocates at least nbytes bytes and reports the usable size of
+ * the allocation, so the caller can use all of its rounded block.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @param actual the location for the usable size, or NULL
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc_at_least(size_t nbytes, size_t *actual) {
+    void *ap = mm_malloc(nbytes);
+    if (ap != NULL && actual != NULL) {
+        *actual = mm_malloc_usable_size(ap);
+    }
+    return ap;
+}
+
+/**
+ * Allocates n objects of nbytes bytes each, carving the blocks of
+ * larger objects from one free block, and stores the pointers to
+ * them in ptrs. Fewer objects are allocated only if memory runs out.
+ *
+ * @param nbytes the number of bytes of each object
+ * @param n the number of objects
+ * @param ptrs the location for the n pointers
+ * @return the number of objects allocated
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void **ptrs) {
+    size_t total;
+    bool carve = (MM_SLAB_MAX == 0 || nbytes > MM_SLAB_MAX) && nbytes <= SIZE_MAX / 2
+                 && !mul_of(mm_blocksize(nbytes), n, &total);
+    size_t count = 0;
+    Arena *a = mm_arena();
+    for (int k = 0; k < narenas && count < n; k++) {
+        MM_LOCK(a);
+#ifdef MM_THREAD_SAFE
+        mm_remote_drain(a);
+#endif
+        if (carve && mm_carve(a, n - count, NULL, nbytes,
+                              (n - count) * mm_blocksize(nbytes), ptrs + count)) {
+            count = n;
+        }
+        // objects of slabs, or what fits when no free block holds all
+        while (count < n) {
+            void *ap = mm_central_malloc(a, nbytes);
+            if (ap == NULL) {
+                break;
+            }
+            ptrs[count++] = ap;
+        }
+        MM_UNLOCK(a);
+        a = &arenas[(a - arenas + 1) % narenas];
+    }
+    if (count < n) {
+        errno = ENOMEM;
+    }
+    return count;
+}
+
+/**
+ * Allocates n objects of the sizes in sizes adjacent in memory,
+ * carving their blocks from one free block, and stores the pointers
+ * to them in ptrs. Each object is freed on its own.
+ *
+ * @param n the number of objects
+ * @param sizes the number of bytes of each object
+ * @param ptrs the location for the n pointers
+ * @return ptrs or NULL if not available, with no objects allocated
+ */
+void **mm_malloc_multi(size_t n, const size_t *sizes, void **ptrs) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sizes[i] > SIZE_MAX / 4 || (total += mm_blocksize(sizes[i])) > SIZE_MAX / 4) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    if (n == 0) {
+        return ptrs;
+    }
+    Arena *a = mm_arena();
+    for (int k = 0; k < narenas; k++) {
+        MM_LOCK(a);
+#ifdef MM_THREAD_SAFE
+        mm_remote_drain(a);
+#endif
+        bool done = mm_carve(a, n, sizes, 0, total, ptrs);
+        MM_UNLOCK(a);
+        if (done) {
+            return ptrs;
+        }
+        a = &arenas[(a - arenas + 1) % narenas];
+    }
+    errno = ENOMEM;
+    return NULL;
+}
+
+/**
+ * Compare two pointers by address for qsort().
+ *
+ * @param p1 pointer to the first pointer
+ * @param p2 pointer to the second pointer
+ * @return negative, zero or positive as the first address is lower,
+ *  equal or higher
+ */
+static int mm_ptrcmp(const void *p1, const void *p2) {
+    uintptr_t a1 = (uintptr_t)*(void * const *)p1;
+    uintptr_t a2 = (uintptr_t)*(void * const *)p2;
+    return (a1 > a2) - (a1 < a2);
+}
+
+/**
+ * Deallocates the n memory allocations pointed to by ptrs, in
+ * increasing address order so that adjacent blocks are released
+ * together. The ptrs are sorted in place; NULL pointers are ignored.
+ *
+ * @param ptrs the memory to free
+ * @param n the number of pointers
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if ((uintptr_t)ptrs[i - 1] > (uintptr_t)ptrs[i]) {
+            qsort(ptrs, n, sizeof(void *), mm_ptrcmp);
+            break;
+        }
+    }
+    size_t i = 0;
+    while (i < n && ptrs[i] == NULL) {
+        i++;
+    }
+    while (i < n) {
+        // the allocations of an arena are adjacent once sorted
+        Arena *a = mm_arena_of(ptrs[i]);
+        size_t j = i + 1;
+        while (j < n && mm_arena_of(ptrs[j]) == a) {
+            j++;
+        }
+#ifdef MM_THREAD_SAFE
+        if (a != mm_arena()) {
+            // freed by a thread of another arena
+            for (; i < j; i++) {
+                mm_remote_free(a, ptrs[i], mm_usable(ptrs[i]));
+            }
+            continue;
+        }
+#endif
+        MM_LOCK(a);
+        mm_central_free_sorted(a, ptrs + i, j - i);
+        MM_UNLOCK(a);
+        i = j;
+    }
+}
+
+/**
+ * Create the initial heap: a padding word so that payloads are
+ * aligned, an allocated prologue block that is before the first
+ * block, and an allocated epilogue header of size 0 that is after
+ * the last block, so coalescing needs no checks for the heap bounds.
+ *
+ * @param a the arena
+ * @return true if the heap was created
+ */
+static bool mm_prologue(Arena *a) {
+    char *p = mm_mem_sbrk(a, 2 * MM_ALIGN);
+    if (p == (char *) -1) {	// no space
+        return false;
+    }
+    Header *bp = (Header *)(p + MM_ALIGN - MM_WSIZE);
+    bp->size = MM_ALIGN | MM_ALLOC;
+    mm_after(bp)->size = MM_ALLOC;
+    return true;
+}
+
+/**
+ * Get the free block at the end of the heap of an arena.
+ *
+ * @param a the arena
+ * @return the last block if it is free, otherwise NULL
+ */
+static Header *mm_topfree(Arena *a) {
+    if (mm_arena_size(a) == 0) {
+        return NULL;
+    }
+    Header *ep = (Header *)((char *)mem_region_hi(a->region) + 1 - MM_WSIZE);
+    return mm_isPrevFree(ep) ? mm_before(ep) : NULL;
+}
+
+/**
+ * Extend the heap of an arena by nbytes bytes and add them to its
+ * free lists, coalesced with a free block at the end of the heap.
+ *
+ * @param a the arena
+ * @param nbytes the number of bytes to be added
+ * @return the free block containing the additional memory
+ */
+static Header *mm_sbrk(Arena *a, size_t nbytes) {
+    if (mm_arena_size(a) == 0 && !mm_prologue(a)) {
+        return NULL;
+    }
+    void* p = mm_mem_sbrk(a, nbytes);
+    if (p == (char *) -1) {	// no space
+        return NULL;
+    }
+
+    // new block starts at the old epilogue header
+    Header* bp = mm_block(p);
+    ((Header *)((char *)bp + nbytes))->size = MM_ALLOC;
+    mm_setAlloc(bp, nbytes);
+    // the new space is zero, and stays so if the free block it joins is
+    Header *top = mm_isPrevFree(bp) ? mm_before(bp) : NULL;
+    bool zero = (top == NULL || (top->size & MM_ZERO) != 0);
+    // add new space to the free lists
+    Header *fp = mm_release(a, bp);
+    if (zero) {
+        if (top != NULL) {
+            // the footer of the free block and old epilogue are now payload
+            *((size_t *)bp - 1) = 0;
+            bp->size = 0;
+        }
+        fp->size |= MM_ZERO;
+    }
+    return fp;
+}
 
-    if (freep == freep->s.ptr) {          /* self-pointing list = empty */
-        fprintf(stderr, "    List has 1 block\n\n");
-        char* str = "    ";
-        fprintf(stderr, "%sptr: %10p size: %3lu blks - %5lu bytes\n", str, (void *)freep, freep->s.size, mm_bytes(freep->s.size));
+/**
+ * Add a chunk allocated from the arenas to the heap of a heap handle.
+ * The chunk is at least the growth chunk of the heap, which doubles
+ * with every call up to MM_GROW_MAX bytes, and holds its links, a
+ * prologue, the new free block, an epilogue and a pointer back to
+ * the chunk.
+ *
+ * @param a the arena of the heap handle
+ * @param nbytes the size of the block needed
+ * @return the free block containing the additional memory
+ */
+static Header *mm_heap_morecore(Arena *a, size_t nbytes) {
+    if (a->growsize == 0) {
+        a->growsize = mem_pagesize();
+    }
+    size_t size = (nbytes < a->growsize) ? a->growsize : nbytes;
+    if (a->growsize < MM_GROW_MAX) {
+        a->growsize *= 2;
+    }
+    if (size > SIZE_MAX - 4 * MM_ALIGN) {
+        return NULL;
+    }
+    Chunk *cp = mm_malloc(size + 4 * MM_ALIGN);
+    if (cp == NULL) {
+        return NULL;
+    }
+    size = (mm_usable(cp) & ~MM_FLAGS) - 4 * MM_ALIGN;
+    cp->prev = NULL;
+    cp->next = a->chunks;
+    if (cp->next != NULL) {
+        cp->next->prev = cp;
+    }
+    a->chunks = cp;
+    a->stats.heap_size += mm_usable(cp);
+    a->stats.sbrk_calls++;
+
+    Header *bp = (Header *)((char *)cp + 2 * MM_ALIGN - MM_WSIZE);
+    bp->size = MM_ALIGN | MM_ALLOC;     // prologue
+    bp = mm_after(bp);
+    bp->size = MM_ALLOC;
+    Header *ep = (Header *)((char *)bp + size);
+    ep->size = MM_ALLOC;                // epilogue
+    *(Chunk **)(ep + 1) = cp;
+    mm_setAlloc(bp, size);
+    // add new space to the free lists
+    return mm_release(a, bp);
+}
+
+/**
+ * Request additional memory to be added to this process. The heap
+ * grows by at least the growth chunk, which doubles with every call
+ * up to MM_GROW_MAX bytes, or by just the bytes needed if the heap
+ * has no room for the chunk.
+ *
+ * @param a the arena
+ * @param nbytes the size of the block needed
+ * @return the free block containing the additional memory
+ */
+static Header *morecore(Arena *a, size_t nbytes) {
+    if (a->region < 0) {
+        return mm_heap_morecore(a, nbytes);
+    }
+    // a free block at the end of the heap grows into the new space
+    Header *top = mm_topfree(a);
+    if (top != NULL && mm_size(top) < nbytes) {
+        nbytes -= mm_size(top);
+    }
+
+    if (a->growsize == 0) {
+        a->growsize = mem_pagesize();
+    }
+    if (nbytes < a->growsize) {
+        Header *bp = mm_sbrk(a, a->growsize);
+        if (a->growsize < MM_GROW_MAX) {
+            a->growsize *= 2;
+        }
+        if (bp != NULL) {
+            return bp;
+        }
+    }
+    return mm_sbrk(a, nbytes);
+}
+
+/**
+ * Extend the heap of the arena of the calling thread so that a free
+ * block of at least nbytes bytes is at its end, so that requests up
+ * to that size do not need to grow the heap.
+ *
+ * @param nbytes the number of bytes to reserve
+ * @return 0 if reserved, or -1 if not available
+ */
+int mm_reserve(size_t nbytes) {
+    if (nbytes > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t size = mm_blocksize(nbytes);
+    int res = 0;
+    Arena *a = mm_arena();
+    MM_LOCK(a);
+    Header *top = mm_topfree(a);
+    if (top == NULL || mm_size(top) < size) {
+        if (mm_sbrk(a, (top != NULL) ? size - mm_size(top) : size) == NULL) {
+            errno = ENOMEM;
+            res = -1;
+        }
+    }
+    MM_UNLOCK(a);
+    return res;
+}
+
+/**
+ * Shrink the heap of an arena so that the free block at its end
+ * keeps the block size for pad bytes, with the arena lock held.
+ * The heap shrinks by whole pages.
+ *
+ * @param a the arena
+ * @param pad the number of free bytes to keep
+ * @return true if the heap was shrunk
+ */
+static bool mm_arena_trim(Arena *a, size_t pad) {
+    Header *bp = mm_topfree(a);
+    if (bp == NULL || pad > SIZE_MAX / 2) {
+        return false;
+    }
+    size_t size = mm_size(bp);
+    size_t keep = mm_blocksize(pad);
+    if (keep >= size) {
+        return false;
+    }
+    size_t decr = (size - keep) & ~(mem_pagesize() - 1);
+    if (decr == 0) {
+        return false;
+    }
+    // the block keeps its payload, so it stays zero if it was
+    size_t zero = bp->size & MM_ZERO;
+    mm_unlink(a, bp);
+    size -= decr;
+    ((Header *)((char *)bp + size))->size = MM_ALLOC;   // new epilogue
+    mm_setFree(bp, size);
+    bp->size |= zero;
+    mm_link(a, bp);
+    mem_region_trim(a->region, decr);
+    MM_SUB(&heap_total, decr);
+    return true;
+}
+
+/**
+ * Returns free memory at the end of the heap of each arena to the
+ * system by shrinking the heap, keeping pad bytes of it so that
+ * requests up to that size do not need to grow the heap again.
+ * The objects cached by the calling thread and by the CPUs it may
+ * run on and those on remote free lists are first returned to their
+ * arenas, and the slabs kept with all their objects free are
+ * returned to the free lists.
+ *
+ * @param pad the number of free bytes to keep at the end of the heap
+ * @return 1 if memory was returned, otherwise 0
+ */
+int mm_trim(size_t pad) {
+#ifdef MM_THREAD_SAFE
+    mm_tcache_flushall(mm_tcache());
+#endif
+#ifdef MM_RSEQ
+    struct rseq *rs = mm_rseq();
+    cpu_set_t cpus;
+    if (rs != NULL && sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        // run on each CPU in turn to empty its cache
+        for (unsigned cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; cpu++) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            if (CPU_ISSET(cpu, &cpus) && sched_setaffinity(0, sizeof(one), &one) == 0) {
+                mm_pcpu_flushall(rs);
+            }
+        }
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+#endif
+    int res = 0;
+    for (int i = 0; i < narenas; i++) {
+        Arena *a = &arenas[i];
+        MM_LOCK(a);
+#ifdef MM_THREAD_SAFE
+        mm_remote_drain(a);
+#endif
+        for (size_t cls = 0; cls < MM_SLAB_CLASSES; cls++) {
+            // only the last slab of a class is kept when all free
+            Slab *sp = a->slabs[cls];
+            if (sp != NULL && sp->nfree == sp->nobjs) {
+                mm_slab_release(a, sp);
+            }
+        }
+        if (mm_arena_trim(a, pad)) {
+            res = 1;
+        }
+        MM_UNLOCK(a);
+    }
+    return res;
+}
+
+/**
+ * Create a heap whose objects are all released at once when the
+ * heap is destroyed. Its memory is chunks allocated from the arenas.
+ *
+ * @return the heap or NULL if not available
+ */
+mm_heap_t *mm_heap_create(void) {
+    mm_heap_t *hp = mm_malloc(sizeof(mm_heap_t));
+    if (hp == NULL) {
+        return NULL;
+    }
+    memset(hp, 0, sizeof(mm_heap_t));
+    hp->arena.region = -1;
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_init(&hp->arena.lock, NULL);
+#endif
+    return hp;
+}
+
+/**
+ * Allocates nbytes bytes from a heap.
+ *
+ * @param hp the heap
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_heap_malloc(mm_heap_t *hp, size_t nbytes) {
+    MM_LOCK(&hp->arena);
+    void *ap = mm_central_malloc(&hp->arena, nbytes);
+    MM_UNLOCK(&hp->arena);
+    return ap;
+}
+
+/**
+ * Deallocates memory allocated from a heap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param hp the heap
+ * @param ap the memory to free
+ */
+void mm_heap_free(mm_heap_t *hp, void *ap) {
+    if (ap == NULL) {
         return;
     }
+    MM_LOCK(&hp->arena);
+    mm_central_free(&hp->arena, ap);
+    MM_UNLOCK(&hp->arena);
+}
+
+/**
+ * Changes the size of memory allocated from a heap, as mm_realloc().
+ *
+ * @param hp the heap
+ * @param ap pointer to memory allocated from the heap
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void *mm_heap_realloc(mm_heap_t *hp, void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_heap_malloc(hp, newsize);
+	}
+    MM_LOCK(&hp->arena);
+    void *newap = mm_central_realloc(&hp->arena, ap, newsize);
+    MM_UNLOCK(&hp->arena);
+    return newap;
+}
 
-    char* str = "    ";
-    for (Header *p = mm_next(freep); true; p = p->s.ptr) {
-        fprintf(stderr, "%sptr: %10p size: %3lu blks - %5lu bytes\n", 
-        	str, (void *)p, p->s.size, mm_bytes(p->s.size));
-        str = " -> ";
-        if ( p == freep) break;
+/**
+ * Destroy a heap, releasing all its objects by freeing its chunks
+ * without visiting the objects.
+ *
+ * @param hp the heap
+ */
+void mm_heap_destroy(mm_heap_t *hp) {
+    if (hp == NULL) {
+        return;
     }
+    Chunk *cp = hp->arena.chunks;
+    while (cp != NULL) {
+        Chunk *next = cp->next;
+        mm_free(cp);
+        cp = next;
+    }
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_destroy(&hp->arena.lock);
+#endif
+    mm_free(hp);
+}
+
+/**
+ * Print the free lists (debugging only)
+ *
+ * @msg the initial message to print
+ */
+void visualize(const char* msg) {
+    fprintf(stderr, "\n--- Free lists after \"%s\":\n", msg);
+
+    for (int i = 0; i < narenas; i++) {
+        Arena *a = &arenas[i];
+        if (narenas > 1) {
+            fprintf(stderr, "  arena %d:\n", i);
+        }
+        if (a->classmap == 0) {                   /* does not exist */
+            fprintf(stderr, "    Lists are empty or not exist\n\n");
+            continue;
+        }
 
+        for (size_t cls = 0; cls < MM_NCLASSES; cls++) {
+            if (a->freelists[cls] == NULL) {
+                continue;
+            }
+            fprintf(stderr, "  class %zu:\n", cls);
+            char* str = "    ";
+            Header *p = a->freelists[cls];
+            do {
+                fprintf(stderr, "%sptr: %10p size: %5zu bytes\n",
+                    str, (void *)p, mm_size(p));
+                str = " -> ";
+                p = mm_next(p);
+            } while (p != a->freelists[cls]);
+        }
+    }
 
     fprintf(stderr, "--- end\n\n");
 }
@@ -525,20 +2839,78 @@ void visualize(const char* msg) {
  * @return the amount of free memory in bytes
  */
 size_t mm_getfree(void) {
-    if (freep == NULL) {
-        return 0;
-    }
+    struct mm_stats st;
+    mm_stats(&st);
+    return st.free_bytes;
+}
 
-	// point to head of free list
-    Header *tmp = freep;
-    size_t res = tmp->s.size;
+/**
+ * Count free objects not yet returned to their arenas as free rather
+ * than allocated in heap statistics.
+ *
+ * @param sp the statistics
+ * @param nblocks the number of objects
+ * @param nbytes the usable bytes of the objects
+ */
+inline static void mm_stats_cached(struct mm_stats *sp, size_t nblocks, size_t nbytes) {
+    sp->alloc_bytes -= nbytes;
+    sp->alloc_blocks -= nblocks;
+    sp->free_bytes += nbytes;
+    sp->free_blocks += nblocks;
+}
 
-	// scan free list and count available memory
-    while (tmp->s.ptr > tmp) {
-        tmp = tmp->s.ptr;
-        res += tmp->s.size;
+/**
+ * Get statistics of the heap, summed over the arenas. The largest
+ * free block is the head of the highest non-empty free list of each
+ * arena, so it is within one size class of the largest; the peak is
+ * that of the heap of all the arenas together; all other values are
+ * counted as the heap changes, so no list is walked. Reading them
+ * leaves the caches as they are: objects cached by the calling
+ * thread, on remote free lists or in per-CPU caches count as free,
+ * those cached by other threads as allocated; the counts of shared
+ * caches are exact only while no thread allocates. An object freed
+ * with mm_free_sized() counts with the size given while cached.
+ *
+ * @param sp the statistics to fill in
+ */
+void mm_stats(struct mm_stats *sp) {
+    memset(sp, 0, sizeof(*sp));
+    for (int i = 0; i < narenas; i++) {
+        Arena *a = &arenas[i];
+        MM_LOCK(a);
+#ifdef MM_THREAD_SAFE
+        mm_stats_cached(sp, MM_LOAD(&a->remote_blocks), MM_LOAD(&a->remote_bytes));
+#endif
+        sp->free_bytes += a->stats.free_bytes;
+        sp->free_blocks += a->stats.free_blocks;
+        sp->alloc_bytes += a->stats.alloc_bytes;
+        sp->alloc_blocks += a->stats.alloc_blocks;
+        sp->sbrk_calls += a->stats.sbrk_calls;
+        sp->heap_size += mm_arena_size(a);
+        if (a->classmap != 0) {
+            size_t cls = 63 - __builtin_clzll(a->classmap);
+            if (mm_size(a->freelists[cls]) > sp->largest_free) {
+                sp->largest_free = mm_size(a->freelists[cls]);
+            }
+        }
+        MM_UNLOCK(a);
     }
-
-	// convert header units to bytes
-    return mm_bytes(res);
+    sp->peak_heap = MM_LOAD(&heap_peak);
+#ifdef MM_THREAD_SAFE
+    if (tcache.generation == generation) {
+        mm_stats_cached(sp, tcache.nobjs, tcache.nbytes);
+    }
+#endif
+#ifdef MM_RSEQ
+    size_t nblocks = 0;
+    size_t nbytes = 0;
+    for (unsigned cpu = 0; cpu < ncpus; cpu++) {
+        CpuCache *cc = &cpucaches[cpu];
+        for (size_t cls = 0; cls < MM_TCACHE_CLASSES; cls++) {
+            nblocks += MM_LOAD(&cc->count[cls]);
+        }
+        nbytes += MM_LOAD(&cc->nbytes);
+    }
+    mm_stats_cached(sp, nblocks, nbytes);
+#endif
 }
@@ -0,0 +1,172 @@
+/*
+ * mm_region.c
+ *
+ * Region (bump) allocator. A region allocates by advancing a
+ * pointer through a chunk allocated from the memory manager and
+ * chains a new chunk when the current one is full. Allocations
+ * are not freed individually; a mark saves the allocation point
+ * and releasing it frees everything allocated since, dropping
+ * the chunks added after the mark.
+ *
+ *  @since Oct 16, 2026
+ *  @author agent
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "mm_heap.h"
+#include "mm_region.h"
+
+/**
+ * Bytes of the first chunk of a region. Each new chunk doubles
+ * the size of the last up to MM_REGION_CHUNK_MAX bytes, or is as
+ * large as the allocation that needs it.
+ */
+#ifndef MM_REGION_CHUNK
+#define MM_REGION_CHUNK 4096
+#endif
+#ifndef MM_REGION_CHUNK_MAX
+#define MM_REGION_CHUNK_MAX (64 * 1024)
+#endif
+
+/** Header at the start of a chunk of a region */
+typedef struct RegionChunk {
+    struct RegionChunk *prev;   /** chunk allocated before this one */
+    char *end;                  /** end of the chunk */
+} RegionChunk;
+
+/** Region: the chunk being allocated from and its bump pointer */
+struct mm_region {
+    RegionChunk *chunk;     /** newest chunk, NULL if none */
+    char *ptr;              /** next free byte of the newest chunk */
+    RegionChunk *spare;     /** chunk kept from the last release, NULL if none */
+    size_t chunksize;       /** bytes of the next chunk */
+};
+
+/**
+ * Create an empty region.
+ *
+ * @return the region or NULL if not available
+ */
+mm_region_t *mm_region_create(void) {
+    mm_region_t *rp = mm_malloc(sizeof(mm_region_t));
+    if (rp != NULL) {
+        memset(rp, 0, sizeof(mm_region_t));
+        rp->chunksize = MM_REGION_CHUNK;
+    }
+    return rp;
+}
+
+/**
+ * Chain a chunk with room for nbytes bytes aligned to align bytes
+ * to a region, reusing the spare chunk if it is large enough.
+ *
+ * @param rp the region
+ * @param nbytes the number of bytes to allocate
+ * @param align the alignment in bytes
+ * @return true if a chunk was chained
+ */
+static bool mm_region_grow(mm_region_t *rp, size_t nbytes, size_t align) {
+    if (nbytes > SIZE_MAX - sizeof(RegionChunk) - align) {
+        return false;
+    }
+    size_t need = sizeof(RegionChunk) + align + nbytes;
+    RegionChunk *cp = rp->spare;
+    if (cp == NULL || (size_t)(cp->end - (char *)cp) < need) {
+        size_t size = (need < rp->chunksize) ? rp->chunksize : need;
+        if ((cp = mm_malloc(size)) == NULL) {
+            return false;
+        }
+        cp->end = (char *)cp + size;
+        if (rp->chunksize < MM_REGION_CHUNK_MAX) {
+            rp->chunksize *= 2;
+        }
+    } else {
+        rp->spare = NULL;
+    }
+    cp->prev = rp->chunk;
+    rp->chunk = cp;
+    rp->ptr = (char *)(cp + 1);
+    return true;
+}
+
+/**
+ * Allocate nbytes bytes aligned to align bytes from a region.
+ *
+ * @param rp the region
+ * @param nbytes the number of bytes to allocate
+ * @param align the alignment in bytes, a power of two
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_region_alloc(mm_region_t *rp, size_t nbytes, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (rp->chunk != NULL) {
+        uintptr_t p = ((uintptr_t)rp->ptr + align - 1) & ~(uintptr_t)(align - 1);
+        if (p >= (uintptr_t)rp->ptr && nbytes <= (uintptr_t)rp->chunk->end - p) {
+            rp->ptr = (char *)p + nbytes;
+            return (void *)p;
+        }
+    }
+    if (!mm_region_grow(rp, nbytes, align)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uintptr_t p = ((uintptr_t)rp->ptr + align - 1) & ~(uintptr_t)(align - 1);
+    rp->ptr = (char *)p + nbytes;
+    return (void *)p;
+}
+
+/**
+ * Get the current allocation point of a region.
+ *
+ * @param rp the region
+ * @return the mark
+ */
+mm_region_mark_t mm_region_mark(mm_region_t *rp) {
+    mm_region_mark_t mark = { rp->chunk, rp->ptr };
+    return mark;
+}
+
+/**
+ * Release all allocations made from a region since a mark. The
+ * chunks chained after the mark are freed, except the largest,
+ * which is kept as a spare for the next chunk.
+ *
+ * @param rp the region
+ * @param mark the mark
+ */
+void mm_region_release(mm_region_t *rp, mm_region_mark_t mark) {
+    while (rp->chunk != mark.chunk) {
+        RegionChunk *cp = rp->chunk;
+        rp->chunk = cp->prev;
+        if (rp->spare == NULL) {
+            rp->spare = cp;
+        } else if (cp->end - (char *)cp > rp->spare->end - (char *)rp->spare) {
+            mm_free(rp->spare);
+            rp->spare = cp;
+        } else {
+            mm_free(cp);
+        }
+    }
+    rp->ptr = mark.ptr;
+}
+
+/**
+ * Destroy a region, releasing all its allocations.
+ *
+ * @param rp the region
+ */
+void mm_region_destroy(mm_region_t *rp) {
+    if (rp == NULL) {
+        return;
+    }
+    mm_region_mark_t empty = { NULL, NULL };
+    mm_region_release(rp, empty);
+    mm_free(rp->spare);
+    mm_free(rp);
+}
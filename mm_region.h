@@ -0,0 +1,65 @@
+/*
+ * mm_region.h
+ *
+ * This file contains definitions of the functions of a region
+ * (bump) allocator whose memory comes from the memory manager.
+ *
+ *  @since Oct 16, 2026
+ *  @author agent
+ */
+
+#ifndef MM_REGION_H_
+#define MM_REGION_H_
+
+#include <stddef.h>
+
+/** Region whose allocations are released together */
+typedef struct mm_region mm_region_t;
+
+/** Saved allocation point of a region, see mm_region_mark() */
+typedef struct mm_region_mark {
+    void *chunk;            /** chunk in use when marked */
+    char *ptr;              /** next free byte of the chunk */
+} mm_region_mark_t;
+
+/**
+ * Create an empty region.
+ *
+ * @return the region or NULL if not available
+ */
+mm_region_t *mm_region_create(void);
+
+/**
+ * Allocate nbytes bytes aligned to align bytes from a region.
+ *
+ * @param rp the region
+ * @param nbytes the number of bytes to allocate
+ * @param align the alignment in bytes, a power of two
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_region_alloc(mm_region_t *rp, size_t nbytes, size_t align);
+
+/**
+ * Get the current allocation point of a region.
+ *
+ * @param rp the region
+ * @return the mark
+ */
+mm_region_mark_t mm_region_mark(mm_region_t *rp);
+
+/**
+ * Release all allocations made from a region since a mark.
+ *
+ * @param rp the region
+ * @param mark the mark
+ */
+void mm_region_release(mm_region_t *rp, mm_region_mark_t mark);
+
+/**
+ * Destroy a region, releasing all its allocations.
+ *
+ * @param rp the region
+ */
+void mm_region_destroy(mm_region_t *rp);
+
+#endif /* MM_REGION_H_ */
@@ -0,0 +1,1185 @@
+/*
+ * mm_tlsf_heap.c
+ *
+ * Two-level segregated fit (TLSF) memory manager. Free blocks
+ * are kept in lists indexed by a first level (power of two of
+ * the block size) and a second level (linear subdivision of that
+ * power of two). Bitmaps of the non-empty lists at both levels
+ * let malloc and free find and merge blocks in constant time.
+ *
+ * Blocks use the same header/footer boundary tags as the K&R
+ * allocator in mm_kr_heap.c.
+ *
+ *  @since Oct 16, 2026
+ *  @author agent
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include "memlib.h"
+#include "mm_heap.h"
+
+
+/** Allocation unit for header of memory blocks */
+typedef union Header {
+    struct {
+        union Header *ptr;  /** next block if on free list */
+        size_t size;        /** size of this block including header */
+                            /** measured in multiple of header size */
+    } s;
+    max_align_t _align;     /** force alignment to max align boundary */
+} Header;
+
+/**
+ * Second level index: each power of two of block sizes is divided
+ * into TLSF_SL_COUNT linear ranges. Sizes below TLSF_SL_COUNT units
+ * all map to first level 0 with one exact size per second level.
+ */
+#define TLSF_SL_SHIFT 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_SHIFT)
+/** First level index: one per power of two of block sizes */
+#define TLSF_FL_COUNT 32
+
+/**
+ * When a free block of at least MM_PURGE_MIN bytes results from
+ * mm_free, its whole pages are returned to the system. 0 disables
+ * purging.
+ */
+#ifndef MM_PURGE_MIN
+#define MM_PURGE_MIN (256 * 1024)
+#endif
+
+// forward declarations
+static Header *morecore(size_t);
+static Header *mm_release(Header *bp);
+
+/*
+ * Check whether multiply overflows (true if overflow)
+ * Extracted from:
+ *   https://github.com/Cloudef/chck/blob/master/chck/overflow/overflow.h
+ */
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+#if __GNUC__ >= 5 || __has_builtin(__builtin_add_overflow)
+/* assume clang and gcc (>=5) to only have builtins for now. */
+#define mul_of(a, b, r) __builtin_mul_overflow(a, b, r)
+#else
+/* else use generic, note behaviour is not strictly defined in C. */
+#define mul_of(a, b, r) (((*(r) = ((a) * (b))) || *(r) == 0) && ((a) != 0 && (b) > *(r) / (a)))
+#endif
+
+/** Heads of the circular free lists */
+static Header *freelists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+/** Bit fl set if any list of first level fl is non-empty */
+static uint32_t flmap = 0;
+/** Bit sl of slmap[fl] set if freelists[fl][sl] is non-empty */
+static uint32_t slmap[TLSF_FL_COUNT];
+/** Running heap statistics (heap_size and largest_free computed) */
+static struct mm_stats stats;
+/** true if mm_realloc left a free block of MM_PURGE_MIN bytes unpurged */
+static bool unpurged = false;
+
+/**
+ * Empty all the free lists.
+ */
+static void mm_clearlists(void) {
+    memset(freelists, 0, sizeof(freelists));
+    unpurged = false;
+    memset(slmap, 0, sizeof(slmap));
+    flmap = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Initialize memory allocator
+ */
+void mm_init(void) {
+	mem_init();
+    mm_clearlists();
+}
+
+/**
+ * Reset memory allocator.
+ */
+void mm_reset(void) {
+    mem_reset_brk();
+    mm_clearlists();
+}
+
+/**
+ * De-initialize memory allocator.
+ */
+void mm_deinit(void) {
+	mem_deinit();
+    mm_clearlists();
+}
+
+/**
+ * Allocation units for nbytes bytes.
+ *
+ * @param nbytes number of bytes
+ * @return number of units for nbytes
+ */
+inline static size_t mm_units(size_t nbytes) {
+    /* smallest count of Header-sized memory chunks */
+    /*  (+2 additional chunks for the header and footer) needed to hold nbytes */
+    return (nbytes + 2 * sizeof(Header) - 1) / sizeof(Header) + 1;
+}
+
+/**
+ * Allocation bytes for nunits allocation units.
+ *
+ * @param nunits number of units
+ * @return number of bytes for nunits
+ */
+inline static size_t mm_bytes(size_t nunits) {
+    return nunits * sizeof(Header);
+}
+
+/**
+ * Get pointer to block payload.
+ *
+ * @param bp the block
+ * @return pointer to allocated payload
+ */
+inline static void *mm_payload(Header *bp) {
+	return bp + 1;
+}
+
+/**
+ * Get pointer to block for payload.
+ *
+ * @param ap the allocated payload pointer
+ */
+inline static Header *mm_block(void *ap) {
+	return (Header*)ap - 1;
+}
+
+/**
+ *  get pointer to block footer from header pointer
+ *
+ * @param hp the header pointer
+ */
+inline static Header *mm_footer(Header *hp) {
+    return hp + hp->s.size - 1;
+}
+
+/**
+ * get pointer to block header from footer pointer
+ *
+ * @param ap the footer pointer
+ */
+inline static Header *mm_header(Header *fp) {
+    return fp - fp->s.size + 1;
+}
+
+/**
+ * get size of blocks in header units
+ *
+ * @param bp the block pointer
+ */
+inline static size_t mm_size(Header *bp) {
+    return bp->s.size;
+}
+
+/**
+ * set size of block in header units
+ *
+ * @param bp the block pointer
+ */
+inline static void mm_setSize(Header *bp, size_t size) {
+    bp->s.size = size;
+    mm_footer(bp)->s.size = size;
+}
+
+/**
+ * get next block in free list
+ *
+ * @param bp the block pointer
+ */
+inline static Header *mm_next(Header *bp) {
+    return bp->s.ptr;
+}
+
+/**
+ * set next block in free list
+ *
+ * @param bp the block pointer
+ * @param next the next block pointer
+ */
+inline static void mm_setNext(Header *bp, Header *next) {
+    bp->s.ptr = next;
+}
+
+/**
+ * get prev block in free list
+ *
+ * @param bp the block pointer
+ */
+inline static Header *mm_prev(Header *bp) {
+   return mm_footer(bp)->s.ptr;
+}
+
+/**
+ * set prev block in free list
+ *
+ * @param bp the block pointer
+ * @param prev the prev block pointer
+ */
+inline static void mm_setPrev(Header *bp, Header *prev) {
+    mm_footer(bp)->s.ptr = prev;
+}
+
+/**
+ * get block before in memory (NULL if no block)
+ *
+ * @param bp the block pointer
+ */
+inline static Header * mm_before(Header *bp) {
+    if ((void *) bp <= mem_heap_lo()) {
+        return NULL;
+    }
+    return mm_header(bp - 1);
+}
+
+/**
+ * get block after in memory (NULL if no block)
+ *
+ * @param bp the block pointer
+ */
+inline static Header * mm_after(Header *bp) {
+    if ((void *)(bp + bp->s.size) > mem_heap_hi()) {
+        return NULL;
+    }
+    return bp + bp->s.size;
+}
+
+/**
+ * index of the most significant bit set
+ *
+ * @param n a non-zero value
+ */
+inline static int mm_fls(size_t n) {
+    return sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(n);
+}
+
+/**
+ * map a block size to its first and second level list indexes
+ *
+ * @param nunits the block size in header units
+ * @param fl returns the first level index
+ * @param sl returns the second level index
+ */
+inline static void mm_mapping(size_t nunits, int *fl, int *sl) {
+    if (nunits < TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = (int)nunits;
+    } else {
+        int log2 = mm_fls(nunits);
+        *fl = log2 - TLSF_SL_SHIFT + 1;
+        *sl = (int)(nunits >> (log2 - TLSF_SL_SHIFT)) - TLSF_SL_COUNT;
+        if (*fl >= TLSF_FL_COUNT) {
+            // clamp oversize blocks into the last list
+            *fl = TLSF_FL_COUNT - 1;
+            *sl = TLSF_SL_COUNT - 1;
+        }
+    }
+}
+
+/**
+ * map a request size to the first list whose blocks are all large
+ * enough, by rounding the size up to the next list boundary
+ *
+ * @param nunits the requested size in header units
+ * @param fl returns the first level index
+ * @param sl returns the second level index
+ */
+inline static void mm_mapping_search(size_t nunits, int *fl, int *sl) {
+    if (nunits >= TLSF_SL_COUNT) {
+        int log2 = mm_fls(nunits);
+        if (log2 - TLSF_SL_SHIFT + 2 >= TLSF_FL_COUNT) {
+            // too large for any list
+            *fl = TLSF_FL_COUNT;
+            *sl = 0;
+            return;
+        }
+        nunits += ((size_t)1 << (log2 - TLSF_SL_SHIFT)) - 1;
+    }
+    mm_mapping(nunits, fl, sl);
+}
+
+/**
+ * unlink the block from its free list
+ *
+ * @param bp the block pointer
+ */
+inline static void mm_unlink(Header *bp) {
+    int fl, sl;
+    mm_mapping(mm_size(bp), &fl, &sl);
+    stats.free_bytes -= mm_bytes(mm_size(bp));
+    stats.free_blocks--;
+    if (mm_next(bp) == bp) {
+        // last block in the list
+        freelists[fl][sl] = NULL;
+        slmap[fl] &= ~((uint32_t)1 << sl);
+        if (slmap[fl] == 0) {
+            flmap &= ~((uint32_t)1 << fl);
+        }
+    } else {
+        Header *prev = mm_prev(bp);
+        Header *next = mm_next(bp);
+        mm_setNext(prev, next);
+        mm_setPrev(next, prev);
+        if (freelists[fl][sl] == bp) {
+            freelists[fl][sl] = next;
+        }
+    }
+    mm_setNext(bp, NULL);
+    mm_setPrev(bp, NULL);
+}
+
+/**
+ * link block into the head of the free list for its size
+ *
+ * @param bp the block pointer
+ */
+inline static void mm_link(Header *bp) {
+    int fl, sl;
+    mm_mapping(mm_size(bp), &fl, &sl);
+    stats.free_bytes += mm_bytes(mm_size(bp));
+    stats.free_blocks++;
+    Header *head = freelists[fl][sl];
+    if (head == NULL) {
+        mm_setNext(bp, bp);
+        mm_setPrev(bp, bp);
+        slmap[fl] |= (uint32_t)1 << sl;
+        flmap |= (uint32_t)1 << fl;
+    } else {
+        Header *prev = mm_prev(head);
+        mm_setNext(prev, bp);
+        mm_setPrev(bp, prev);
+        mm_setNext(bp, head);
+        mm_setPrev(head, bp);
+    }
+    freelists[fl][sl] = bp;
+}
+
+/**
+ * Find a free block of at least nunits units with two bitmap
+ * lookups: the rest of the second level of the rounded-up size,
+ * then the first non-empty first level above it. If neither has
+ * a block, the head of the list for the exact size is tried so
+ * that a block just large enough is used before growing the heap.
+ *
+ * @param nunits the required number of units
+ * @return a free block or NULL if none large enough
+ */
+inline static Header *mm_find(size_t nunits) {
+    int fl, sl;
+    mm_mapping_search(nunits, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL;
+    }
+    uint32_t map = slmap[fl] & (~(uint32_t)0 << sl);
+    if (map == 0) {
+        // no block in this first level, use next larger one
+        map = (fl + 1 < TLSF_FL_COUNT) ? flmap & (~(uint32_t)0 << (fl + 1)) : 0;
+        if (map == 0) {
+            // last resort: head of the list for the exact size
+            mm_mapping(nunits, &fl, &sl);
+            Header *p = freelists[fl][sl];
+            return (p != NULL && mm_size(p) >= nunits) ? p : NULL;
+        }
+        fl = __builtin_ctz(map);
+        map = slmap[fl];
+    }
+    sl = __builtin_ctz(map);
+    return freelists[fl][sl];
+}
+
+/**
+ * Allocates size bytes of memory and returns a pointer to the
+ * allocated memory, or NULL if request storage cannot be allocated.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc(size_t nbytes) {
+    if (nbytes > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t nunits = mm_units(nbytes);
+
+    Header *p = mm_find(nunits);
+    if (p == NULL) {
+        // nothing large enough - we need to allocate
+        if (morecore(nunits) == NULL) {
+            errno = ENOMEM;
+            return NULL;                /* none left */
+        }
+        p = mm_find(nunits);
+        if (p == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    mm_unlink(p);
+    if (mm_size(p) > nunits + 1) {
+        // split and return the tail end to the free lists
+        Header *rest = p + nunits;
+        mm_setSize(rest, mm_size(p) - nunits);
+        mm_link(rest);
+        mm_setSize(p, nunits);
+    }
+    mm_setNext(p, NULL);
+    mm_setPrev(p, NULL);
+    stats.alloc_bytes += mm_bytes(mm_size(p) - 2);
+    stats.alloc_blocks++;
+    return mm_payload(p);
+}
+
+/**
+ * Coalesce a block with its free neighbors and link the
+ * result into the free list for its size.
+ *
+ * @param bp the block to release
+ * @return the coalesced free block
+ */
+static Header *mm_release(Header *bp) {
+    Header *p = mm_after(bp);
+    if (p != NULL && mm_next(p) != NULL) {
+        // coalesce with upper neighbor
+        mm_unlink(p);
+        mm_setSize(bp, mm_size(bp) + mm_size(p));
+    }
+
+    p = mm_before(bp);
+    if (p != NULL && mm_next(p) != NULL) {
+        // coalesce with lower neighbor
+        mm_unlink(p);
+        mm_setSize(p, mm_size(p) + mm_size(bp));
+        mm_setNext(bp, NULL);
+        bp = p;
+    }
+    mm_link(bp);
+    return bp;
+}
+
+/**
+ * Release a block and, if the free block that results has at least
+ * MM_PURGE_MIN bytes, return the whole pages between its header and
+ * footer that the release newly joined to the system. A free block
+ * of that size was already purged when it formed, unless mm_realloc
+ * released it, so only the released block and smaller free blocks
+ * it coalesced with are.
+ *
+ * @param bp the block to release
+ * @return the coalesced free block
+ */
+static Header *mm_release_purge(Header *bp) {
+    Header *lo = bp;
+    Header *hi = bp + mm_size(bp);
+    Header *p = mm_after(bp);
+    if (p != NULL && mm_next(p) != NULL && mm_bytes(mm_size(p)) < MM_PURGE_MIN) {
+        hi = p + mm_size(p);
+    }
+    p = mm_before(bp);
+    if (p != NULL && mm_next(p) != NULL && mm_bytes(mm_size(p)) < MM_PURGE_MIN) {
+        lo = p;
+    }
+    bp = mm_release(bp);
+    if (MM_PURGE_MIN != 0 && mm_bytes(mm_size(bp)) >= MM_PURGE_MIN) {
+        // the header and footer of the free block stay in use
+        if (lo <= bp) {
+            lo = bp + 1;
+        }
+        if (hi > mm_footer(bp)) {
+            hi = mm_footer(bp);
+        }
+        mem_purge(lo, mm_bytes(hi - lo));
+    }
+    return bp;
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ */
+void mm_free(void *ap) {
+	// ignore null pointer
+    if (ap == NULL) {
+        return;
+    }
+
+    Header *bp = mm_block(ap);   /* point to block header */
+    // validate size field of header block
+    assert(bp->s.size > 0 && mm_bytes(bp->s.size) <= mem_heapsize());
+    stats.alloc_bytes -= mm_bytes(mm_size(bp) - 2);
+    stats.alloc_blocks--;
+    mm_release_purge(bp);
+}
+
+/**
+ * Deallocates the memory allocation pointed to by ap, whose size
+ * the caller knows: the size requested for it, or at most its
+ * usable size. The block size in the
+ * header is needed to coalesce the block, so the size is only
+ * checked, if MM_CHECK_FREE_SIZE is defined.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param ap the memory to free
+ * @param nbytes the size of the allocation in bytes
+ */
+void mm_free_sized(void *ap, size_t nbytes) {
+#ifdef MM_CHECK_FREE_SIZE
+    assert(ap == NULL || nbytes <= mm_malloc_usable_size(ap));
+#else
+    (void)nbytes;
+#endif
+    mm_free(ap);
+}
+
+/**
+ * Tries to change the size of the allocation pointed to by ap
+ * to size, and returns ap.
+ *
+ * If there is not enough room to enlarge the memory allocation
+ * pointed to by ap, realloc() creates a new allocation, copies
+ * as much of the old data pointed to by ptr as will fit to the
+ * new allocation, frees the old allocation, and returns a pointer
+ * to the allocated memory.
+ *
+ * If ap is NULL, realloc() is identical to a call to malloc()
+ * for size bytes.  If size is zero and ptr is not NULL, a minimum
+ * sized object is allocated and the original object is freed.
+ *
+ * @param ap pointer to allocated memory
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void* mm_realloc(void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_malloc(newsize);
+	}
+
+	if (newsize > SIZE_MAX / 2) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	Header* bp = mm_block(ap);    // point to block header
+	if (newsize > 0) {
+		// return this ap if allocated block large enough
+		if (bp->s.size >= mm_units(newsize)) {
+			return ap;
+		}
+	}
+
+	// allocate new block
+	void *newap = mm_malloc(newsize);
+	if (newap == NULL) {
+		return NULL;
+	}
+	// copy old block to new block
+	size_t oldsize = mm_bytes(bp->s.size-2);
+	memcpy(newap, ap, (oldsize < newsize) ? oldsize : newsize);
+	// the old block is not purged, as a block that keeps growing reuses
+	// it, but mm_trim purges it if it is still free
+	stats.alloc_bytes -= mm_bytes(mm_size(bp) - 2);
+	stats.alloc_blocks--;
+	if (mm_bytes(mm_size(mm_release(bp))) >= MM_PURGE_MIN) {
+		unpurged = true;
+	}
+	return newap;
+}
+
+/**
+ * Contiguously allocates enough space for count objects that are
+ * size bytes of memory each and returns a pointer to the allocated
+ * memory.  The allocated memory is filled with bytes of value zero.
+ *
+ * @param count the number of blocks to allocate
+ * @param size the size of each element
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void* mm_calloc(size_t count, size_t size) {
+	// multiply and check for overflow
+	size_t nbytes; // product
+	if (mul_of(count, size, &nbytes)) { // overflow if true
+		return NULL;
+	}
+
+	void* p = mm_malloc(nbytes);
+	if (p != NULL) {
+		memset(p, 0, nbytes);
+	}
+	return p;
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align.
+ * The block is carved out of a free block whose leading and
+ * trailing slack are returned to the free lists, so the memory
+ * is released by mm_free() and resized by mm_realloc() like any
+ * other; a moving mm_realloc() does not keep the alignment.
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_memalign(size_t align, size_t nbytes) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= sizeof(Header)) {
+        return mm_malloc(nbytes);
+    }
+    if (nbytes > SIZE_MAX / 4 || align > SIZE_MAX / 4) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t nunits = mm_units(nbytes);
+    // large enough for the block at any alignment of a free block
+    size_t need = nunits + align / sizeof(Header) + 2;
+
+    Header *p = mm_find(need);
+    if (p == NULL) {
+        if (morecore(need) == NULL || (p = mm_find(need)) == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    mm_unlink(p);
+    size_t avail = mm_size(p);
+    size_t lead = (-(uintptr_t)mm_payload(p) & (align - 1)) / sizeof(Header);
+    if (lead == 1) {
+        // too small to be a block: use next aligned address
+        lead += align / sizeof(Header);
+    }
+    if (lead > 0) {
+        // return the leading slack to the free lists
+        mm_setSize(p, lead);
+        mm_link(p);
+        p += lead;
+        avail -= lead;
+        mm_setSize(p, avail);
+    }
+    if (avail > nunits + 1) {
+        // return the trailing slack to the free lists
+        Header *rest = p + nunits;
+        mm_setSize(rest, avail - nunits);
+        mm_link(rest);
+        mm_setSize(p, nunits);
+    }
+    mm_setNext(p, NULL);
+    mm_setPrev(p, NULL);
+    stats.alloc_bytes += mm_bytes(mm_size(p) - 2);
+    stats.alloc_blocks++;
+    return mm_payload(p);
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as C11 aligned_alloc().
+ *
+ * @param align the alignment in bytes, a power of two
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_aligned_alloc(size_t align, size_t nbytes) {
+    return mm_memalign(align, nbytes);
+}
+
+/**
+ * Allocates nbytes bytes whose address is a multiple of align,
+ * as POSIX posix_memalign(). Unlike the other allocation
+ * functions, errno is not set.
+ *
+ * @param pp the location for the allocated memory
+ * @param align the alignment in bytes, a power of two multiple
+ *  of sizeof(void *)
+ * @param nbytes the number of bytes to allocate
+ * @return 0, EINVAL if align is not valid, or ENOMEM if not available
+ */
+int mm_posix_memalign(void **pp, size_t align, size_t nbytes) {
+    if (align < sizeof(void *) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    int err = errno;
+    void *ap = mm_memalign(align, nbytes);
+    errno = err;
+    if (ap == NULL) {
+        return ENOMEM;
+    }
+    *pp = ap;
+    return 0;
+}
+
+/**
+ * Get the number of bytes usable in the memory allocation pointed
+ * to by ap, at least the number requested for it.
+ *
+ * @param ap pointer to allocated memory, or NULL
+ * @return the usable size in bytes, or 0 if ap is NULL
+ */
+size_t mm_malloc_usable_size(void *ap) {
+    if (ap == NULL) {
+        return 0;
+    }
+    return mm_bytes(mm_size(mm_block(ap)) - 2);
+}
+
+/**
+ * Allocates at least nbytes bytes and reports the usable size of
+ * the allocation, so the caller can use all of its rounded block.
+ *
+ * @param nbytes the number of bytes to allocate
+ * @param actual the location for the usable size, or NULL
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_malloc_at_least(size_t nbytes, size_t *actual) {
+    void *ap = mm_malloc(nbytes);
+    if (ap != NULL && actual != NULL) {
+        *actual = mm_malloc_usable_size(ap);
+    }
+    return ap;
+}
+
+/**
+ * Allocate n adjacent blocks out of one free block, returning the
+ * rest of the free block to the free lists. The last block takes
+ * any rest too small to be a block.
+ *
+ * @param n the number of blocks
+ * @param sizes the bytes to allocate for each block, or NULL if
+ *  each is nbytes
+ * @param nbytes the bytes to allocate for each block if sizes is NULL
+ * @param total the sum of the block sizes in header units
+ * @param ptrs the location for the n allocated payloads
+ * @return true if the blocks were allocated
+ */
+static bool mm_carve(size_t n, const size_t *sizes, size_t nbytes, size_t total, void **ptrs) {
+    Header *p = mm_find(total);
+    if (p == NULL) {
+        if (morecore(total) == NULL || (p = mm_find(total)) == NULL) {
+            return false;
+        }
+    }
+
+    mm_unlink(p);
+    size_t avail = mm_size(p);
+    for (size_t i = 0; i < n; i++) {
+        size_t nunits = mm_units((sizes != NULL) ? sizes[i] : nbytes);
+        avail -= nunits;
+        if (i == n - 1 && avail < 2) {
+            nunits += avail;
+            avail = 0;
+        }
+        mm_setSize(p, nunits);
+        mm_setNext(p, NULL);
+        mm_setPrev(p, NULL);
+        stats.alloc_bytes += mm_bytes(nunits - 2);
+        stats.alloc_blocks++;
+        ptrs[i] = mm_payload(p);
+        p += nunits;
+    }
+    if (avail > 0) {
+        mm_setSize(p, avail);
+        mm_link(p);
+    }
+    return true;
+}
+
+/**
+ * Allocates n objects of nbytes bytes each, carving their blocks
+ * from one free block, and stores the pointers to them in ptrs.
+ * Fewer objects are allocated only if memory runs out.
+ *
+ * @param nbytes the number of bytes of each object
+ * @param n the number of objects
+ * @param ptrs the location for the n pointers
+ * @return the number of objects allocated
+ */
+size_t mm_malloc_batch(size_t nbytes, size_t n, void **ptrs) {
+    if (nbytes > SIZE_MAX / 2) {
+        errno = ENOMEM;
+        return 0;
+    }
+    size_t total;
+    if (n > 0 && !mul_of(mm_units(nbytes), n, &total)
+        && mm_carve(n, NULL, nbytes, total, ptrs)) {
+        return n;
+    }
+    // what fits when no free block holds all
+    size_t count = 0;
+    while (count < n && (ptrs[count] = mm_malloc(nbytes)) != NULL) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Allocates n objects of the sizes in sizes adjacent in memory,
+ * carving their blocks from one free block, and stores the pointers
+ * to them in ptrs. Each object is freed on its own.
+ *
+ * @param n the number of objects
+ * @param sizes the number of bytes of each object
+ * @param ptrs the location for the n pointers
+ * @return ptrs or NULL if not available, with no objects allocated
+ */
+void **mm_malloc_multi(size_t n, const size_t *sizes, void **ptrs) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sizes[i] > SIZE_MAX / 4 || (total += mm_units(sizes[i])) > SIZE_MAX / 4 / sizeof(Header)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    if (n > 0 && !mm_carve(n, sizes, 0, total, ptrs)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ptrs;
+}
+
+/**
+ * Compare two pointers by address for qsort().
+ *
+ * @param p1 pointer to the first pointer
+ * @param p2 pointer to the second pointer
+ * @return negative, zero or positive as the first address is lower,
+ *  equal or higher
+ */
+static int mm_ptrcmp(const void *p1, const void *p2) {
+    uintptr_t a1 = (uintptr_t)*(void * const *)p1;
+    uintptr_t a2 = (uintptr_t)*(void * const *)p2;
+    return (a1 > a2) - (a1 < a2);
+}
+
+/**
+ * Deallocates the n memory allocations pointed to by ptrs, in
+ * increasing address order so that each run of adjacent blocks
+ * is released as one block. The ptrs are sorted in place; NULL
+ * pointers are ignored.
+ *
+ * @param ptrs the memory to free
+ * @param n the number of pointers
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if ((uintptr_t)ptrs[i - 1] > (uintptr_t)ptrs[i]) {
+            qsort(ptrs, n, sizeof(void *), mm_ptrcmp);
+            break;
+        }
+    }
+    size_t i = 0;
+    while (i < n && ptrs[i] == NULL) {
+        i++;
+    }
+    while (i < n) {
+        Header *bp = mm_block(ptrs[i++]);
+        assert(bp->s.size > 0 && mm_bytes(bp->s.size) <= mem_heapsize());
+        size_t size = mm_size(bp);
+        stats.alloc_bytes -= mm_bytes(size - 2);
+        stats.alloc_blocks--;
+        // blocks of the batch that follow the run join it
+        while (i < n && mm_block(ptrs[i]) == bp + size) {
+            Header *np = mm_block(ptrs[i++]);
+            stats.alloc_bytes -= mm_bytes(mm_size(np) - 2);
+            stats.alloc_blocks--;
+            size += mm_size(np);
+        }
+        mm_setSize(bp, size);
+        mm_release_purge(bp);
+    }
+}
+
+/**
+ * Request additional memory to be added to this process.
+ *
+ * @param nu the number of Header units to be added
+ * @return the free block containing the additional memory
+ */
+static Header *morecore(size_t nu) {
+	// nalloc based on page size
+	size_t nalloc = mem_pagesize()/sizeof(Header);
+
+    /* get at least NALLOC Header-chunks from the OS */
+    if (nu < nalloc) {
+        nu = nalloc;
+    }
+
+    size_t nbytes = mm_bytes(nu); // number of bytes
+    void* p = mem_sbrk(nbytes);
+    stats.sbrk_calls++;
+    if (p == (char *) -1) {	// no space
+        return NULL;
+    }
+    if (mem_heapsize() > stats.peak_heap) {
+        stats.peak_heap = mem_heapsize();
+    }
+
+    Header* bp = (Header*)p;
+    // Need to set size for both header and footer
+    mm_setSize(bp, nu);
+    // add new space to the free lists
+    return mm_release(bp);
+}
+
+/**
+ * Extend the heap so that a free block of at least nbytes bytes
+ * is on the free lists.
+ *
+ * @param nbytes the number of bytes to reserve
+ * @return 0 if reserved, or -1 if not available
+ */
+int mm_reserve(size_t nbytes) {
+    if (nbytes > SIZE_MAX / 2 || morecore(mm_units(nbytes)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Return the whole pages of the free blocks of at least MM_PURGE_MIN
+ * bytes that mm_realloc left unpurged to the system.
+ *
+ * @return true if blocks were purged
+ */
+static bool mm_purge_unpurged(void) {
+    if (MM_PURGE_MIN == 0 || !unpurged) {
+        return false;
+    }
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            Header *head = freelists[fl][sl];
+            if (head == NULL || mm_bytes(mm_size(head)) < MM_PURGE_MIN / 2) {
+                continue;
+            }
+            Header *bp = head;
+            do {
+                if (mm_bytes(mm_size(bp)) >= MM_PURGE_MIN) {
+                    mem_purge(bp + 1, mm_bytes(mm_size(bp) - 2));
+                }
+                bp = mm_next(bp);
+            } while (bp != head);
+        }
+    }
+    unpurged = false;
+    return true;
+}
+
+/**
+ * Returns free memory to the system: the pages of large free blocks
+ * that mm_realloc left unpurged, and the memory at the end of the
+ * heap by shrinking the heap by whole pages, keeping a free block
+ * for pad bytes there so that requests up to that size do not need
+ * to grow the heap again.
+ *
+ * @param pad the number of free bytes to keep at the end of the heap
+ * @return 1 if memory was returned, otherwise 0
+ */
+int mm_trim(size_t pad) {
+    int res = mm_purge_unpurged() ? 1 : 0;
+    if (mem_heapsize() == 0 || pad > SIZE_MAX / 2) {
+        return res;
+    }
+    // the last unit of the heap is the footer of the last block
+    Header *bp = mm_header((Header *)((char *)mem_heap_hi() + 1) - 1);
+    size_t keep = mm_units(pad);
+    if (mm_next(bp) == NULL || mm_size(bp) <= keep) {
+        return res;
+    }
+    size_t decr = mm_bytes(mm_size(bp) - keep) & ~(mem_pagesize() - 1);
+    if (decr == 0) {
+        return res;
+    }
+    mm_unlink(bp);
+    mm_setSize(bp, mm_size(bp) - decr / sizeof(Header));
+    mm_link(bp);
+    mem_trim(decr);
+    return 1;
+}
+
+/** Object of a heap handle, linked into the list of its heap */
+typedef struct HeapObj {
+    struct HeapObj *next;   /** next object of the heap */
+    struct HeapObj *prev;   /** previous object of the heap */
+} HeapObj;
+
+/**
+ * Heap handle: the circular list of its objects. Destroying the
+ * heap frees its objects one at a time.
+ */
+struct mm_heap {
+    HeapObj objs;           /** list head */
+};
+
+/**
+ * Link an object into the list of a heap.
+ *
+ * @param hp the heap
+ * @param op the object
+ */
+inline static void mm_heap_link(mm_heap_t *hp, HeapObj *op) {
+    op->next = hp->objs.next;
+    op->prev = &hp->objs;
+    op->next->prev = op;
+    hp->objs.next = op;
+}
+
+/**
+ * Unlink an object from the list of its heap.
+ *
+ * @param op the object
+ */
+inline static void mm_heap_unlink(HeapObj *op) {
+    op->prev->next = op->next;
+    op->next->prev = op->prev;
+}
+
+/**
+ * Create a heap whose objects are all released at once when the
+ * heap is destroyed.
+ *
+ * @return the heap or NULL if not available
+ */
+mm_heap_t *mm_heap_create(void) {
+    mm_heap_t *hp = mm_malloc(sizeof(mm_heap_t));
+    if (hp != NULL) {
+        hp->objs.next = hp->objs.prev = &hp->objs;
+    }
+    return hp;
+}
+
+/**
+ * Allocates nbytes bytes from a heap.
+ *
+ * @param hp the heap
+ * @param nbytes the number of bytes to allocate
+ * @return pointer to allocated memory or NULL if not available.
+ */
+void *mm_heap_malloc(mm_heap_t *hp, size_t nbytes) {
+    if (nbytes > SIZE_MAX - sizeof(HeapObj)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    HeapObj *op = mm_malloc(sizeof(HeapObj) + nbytes);
+    if (op == NULL) {
+        return NULL;
+    }
+    mm_heap_link(hp, op);
+    return op + 1;
+}
+
+/**
+ * Deallocates memory allocated from a heap.
+ * If ap is a NULL pointer, no operation is performed.
+ *
+ * @param hp the heap
+ * @param ap the memory to free
+ */
+void mm_heap_free(mm_heap_t *hp, void *ap) {
+    (void)hp;
+    if (ap == NULL) {
+        return;
+    }
+    HeapObj *op = (HeapObj *)ap - 1;
+    mm_heap_unlink(op);
+    mm_free(op);
+}
+
+/**
+ * Changes the size of memory allocated from a heap, as mm_realloc().
+ *
+ * @param hp the heap
+ * @param ap pointer to memory allocated from the heap
+ * @param newsize required new memory size in bytes
+ * @return pointer to allocated memory at least required size
+ *	with original content
+ */
+void *mm_heap_realloc(mm_heap_t *hp, void *ap, size_t newsize) {
+	// NULL ap acts as malloc for size newsize bytes
+	if (ap == NULL) {
+		return mm_heap_malloc(hp, newsize);
+	}
+    if (newsize > SIZE_MAX - sizeof(HeapObj)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    HeapObj *op = (HeapObj *)ap - 1;
+    mm_heap_unlink(op);
+    HeapObj *np = mm_realloc(op, sizeof(HeapObj) + newsize);
+    if (np == NULL) {
+        mm_heap_link(hp, op);
+        return NULL;
+    }
+    mm_heap_link(hp, np);
+    return np + 1;
+}
+
+/**
+ * Destroy a heap, releasing all memory allocated from it.
+ *
+ * @param hp the heap
+ */
+void mm_heap_destroy(mm_heap_t *hp) {
+    if (hp == NULL) {
+        return;
+    }
+    HeapObj *op = hp->objs.next;
+    while (op != &hp->objs) {
+        HeapObj *next = op->next;
+        mm_free(op);
+        op = next;
+    }
+    mm_free(hp);
+}
+
+/**
+ * Calculate the total amount of available free memory.
+ *
+ * @return the amount of free memory in bytes
+ */
+size_t mm_getfree(void) {
+    return stats.free_bytes;
+}
+
+/**
+ * Get statistics of the heap. The largest free block is the head
+ * of the highest non-empty free list, found with the bitmaps, so it
+ * is within one list of the largest; all other values are counted
+ * as the heap changes.
+ *
+ * @param sp the statistics to fill in
+ */
+void mm_stats(struct mm_stats *sp) {
+    *sp = stats;
+    sp->heap_size = mem_heapsize();
+    sp->largest_free = 0;
+    if (flmap != 0) {
+        int fl = 31 - __builtin_clz(flmap);
+        int sl = 31 - __builtin_clz(slmap[fl]);
+        sp->largest_free = mm_bytes(mm_size(freelists[fl][sl]));
+    }
+}
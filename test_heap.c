@@ -16,19 +16,39 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "mm_heap.h"
+#include "mm_region.h"
+#include "memlib.h"
 
 /**
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: test_heap [-hvd]] <file1> [...<file>]\n");
+    fprintf(stderr, "Usage: test_heap [-hvdrHbaumszt] [-M <mb>] [-T <n>] <file1> [...<file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print detailed performance info.\n");
     fprintf(stderr, "\t-d         Print debug information.\n");
+    fprintf(stderr, "\t-r         Reserve the suggested heap size of each trace.\n");
+    fprintf(stderr, "\t-H         Allocate from a heap handle destroyed after each trace.\n");
+    fprintf(stderr, "\t-b         Benchmark a region against mm_malloc() for each trace.\n");
+    fprintf(stderr, "\t-a         Test aligned allocation before the traces.\n");
+    fprintf(stderr, "\t-u         Use the usable size of blocks, reallocating only beyond it.\n");
+    fprintf(stderr, "\t-m         Test batch allocation and free before the traces.\n");
+    fprintf(stderr, "\t-s         Free blocks with mm_free_sized().\n");
+    fprintf(stderr, "\t-z         Allocate blocks with mm_calloc() and check they are zero.\n");
+    fprintf(stderr, "\t-t         Test trimming the heap after each trace.\n");
+    fprintf(stderr, "\t-M <mb>    Limit the heap to <mb> megabytes.\n");
+    fprintf(stderr, "\t-T <n>     Test <n> threads freeing each other's blocks before\n");
+    fprintf(stderr, "\t           the traces (needs the kr heap built with -DMM_THREAD_SAFE).\n");
     fprintf(stderr, "\t<file>     Use <file> as the trace file.\n");
 }
 
@@ -39,8 +59,529 @@ typedef struct {
 	int errors;
 	int ops;
 	float secs;
+	size_t heapsize;	/* heap size at end of trace */
+	size_t peakbytes;	/* peak bytes requested and not yet freed */
 } TraceInfo;
 
+/** Number of times the benchmark repeats the allocations of a trace */
+#define BENCH_ROUNDS 20
+
+/**
+ * Benchmark allocating the sizes of the allocations of a trace
+ * with mm_malloc()/mm_free() pairs and from a region released to
+ * a mark, and report the rate of each.
+ *
+ * @param name the trace name
+ * @param sizes the allocation sizes
+ * @param n the number of allocations
+ */
+static void benchmark(const char *name, const int *sizes, int n) {
+	if (n == 0) {
+		return;
+	}
+	void **ptrs = malloc(n * sizeof(void *));
+	if (ptrs == NULL) {
+		return;
+	}
+
+	clock_t t = clock();
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		for (int i = 0; i < n; i++) {
+			ptrs[i] = mm_malloc(sizes[i]);
+		}
+		for (int i = 0; i < n; i++) {
+			mm_free(ptrs[i]);
+		}
+	}
+	double malloc_secs = ((double) (clock()-t)) / CLOCKS_PER_SEC;
+
+	mm_region_t *rp = mm_region_create();
+	if (rp == NULL) {
+		free(ptrs);
+		return;
+	}
+	mm_region_mark_t mark = mm_region_mark(rp);
+	t = clock();
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		for (int i = 0; i < n; i++) {
+			ptrs[i] = mm_region_alloc(rp, sizes[i], sizeof(max_align_t));
+		}
+		mm_region_release(rp, mark);
+	}
+	double region_secs = ((double) (clock()-t)) / CLOCKS_PER_SEC;
+	mm_region_destroy(rp);
+	free(ptrs);
+
+	double ops = (double)n * BENCH_ROUNDS / 1e3;
+	fprintf(stderr, "Benchmark %s: mm_malloc/mm_free %d Kops, region %d Kops\n", name,
+			(malloc_secs > 0) ? (int)(ops/malloc_secs) : 0,
+			(region_secs > 0) ? (int)(ops/region_secs) : 0);
+}
+
+/**
+ * Test aligned allocation with mm_memalign(), mm_aligned_alloc()
+ * and mm_posix_memalign() at several alignments and sizes: each
+ * allocation must be aligned, writable, keep its content when
+ * resized by mm_realloc(), and be released by mm_free().
+ *
+ * @param debug true to print each error
+ * @return the number of errors
+ */
+static int test_aligned(bool debug) {
+	static const size_t aligns[] = { 64, 4096, 2*1024*1024 };
+	static const size_t sizes[] = { 5000, 100, 1 };
+	int nerrors = 0;
+
+	for (size_t i = 0; i < sizeof(aligns)/sizeof(aligns[0]); i++) {
+		for (size_t j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+			size_t align = aligns[i], size = sizes[j];
+			void *ptrs[3] = { NULL, NULL, NULL };
+			ptrs[0] = mm_memalign(align, size);
+			ptrs[1] = mm_aligned_alloc(align, size);
+			if (mm_posix_memalign(&ptrs[2], align, size) != 0) {
+				ptrs[2] = NULL;
+			}
+			for (int k = 0; k < 3; k++) {
+				if (ptrs[k] == NULL || ((uintptr_t)ptrs[k] & (align - 1)) != 0) {
+					if (debug) fprintf(stderr, "aligned allocation %d of %zu bytes at %zu: %p\n",
+							k, size, align, ptrs[k]);
+					nerrors++;
+				} else {
+					memset(ptrs[k], k + 1, size);
+				}
+			}
+
+			// a resized allocation keeps its content
+			if (ptrs[0] != NULL) {
+				unsigned char *p = mm_realloc(ptrs[0], 2 * size);
+				if (p == NULL) {
+					nerrors++;
+				} else {
+					ptrs[0] = p;
+					for (size_t n = 0; n < size; n++) {
+						if (p[n] != 1) {
+							if (debug) fprintf(stderr, "realloc of aligned %zu bytes at %zu: "
+									"content changed\n", size, align);
+							nerrors++;
+							break;
+						}
+					}
+				}
+			}
+			for (int k = 0; k < 3; k++) {
+				mm_free(ptrs[k]);
+			}
+		}
+	}
+
+	// alignments that are not a power of two
+	void *p = NULL;
+	if (mm_posix_memalign(&p, 24, 8) != EINVAL || mm_memalign(3, 8) != NULL) {
+		if (debug) fprintf(stderr, "invalid alignment accepted\n");
+		nerrors++;
+	}
+
+	struct mm_stats stats;
+	mm_stats(&stats);
+	if (stats.alloc_blocks != 0) {
+		if (debug) fprintf(stderr, "%zu aligned allocations not freed\n", stats.alloc_blocks);
+		nerrors++;
+	}
+	return nerrors;
+}
+
+/** Bytes allocated with mm_calloc() by test_trim() after trimming */
+#define TRIM_CHECK (1 << 20)
+/** Heap bytes that may remain when all blocks are freed and the heap trimmed */
+#define TRIM_SLACK (64 * 1024)
+
+/**
+ * Test mm_trim() at the end of a trace: the heap must not grow, and
+ * shrink only if it reports memory returned; once the blocks left
+ * by the trace are freed, it must shrink to at most TRIM_SLACK
+ * bytes; and memory allocated with mm_calloc() over the trimmed
+ * end of the heap must be zero.
+ *
+ * @param debug true to print each error
+ * @param blocks the blocks of the trace, NULL if freed
+ * @param nblocks the number of blocks
+ * @return the number of errors
+ */
+static int test_trim(bool debug, void *blocks[], int nblocks) {
+	int nerrors = 0;
+	size_t before = mem_heapsize();
+	int res = mm_trim(0);
+	size_t after = mem_heapsize();
+	if (after > before || (res == 0 && after != before)) {
+		if (debug) fprintf(stderr, "mm_trim returned %d, heap %zu bytes before, %zu after\n",
+							res, before, after);
+		nerrors++;
+	}
+	for (int i = 0; i < nblocks; i++) {
+		mm_free(blocks[i]);
+		blocks[i] = NULL;
+	}
+	mm_trim(0);
+	if (mem_heapsize() > TRIM_SLACK) {
+		if (debug) fprintf(stderr, "heap %zu bytes after freeing all blocks and mm_trim\n",
+							mem_heapsize());
+		nerrors++;
+	}
+	char *p = mm_calloc(1, TRIM_CHECK);
+	if (p == NULL) {
+		if (debug) fprintf(stderr, "%d bytes not allocated after mm_trim\n", TRIM_CHECK);
+		return nerrors + 1;
+	}
+	for (int i = 0; i < TRIM_CHECK; i++) {
+		if (p[i] != 0) {
+			if (debug) fprintf(stderr, "block allocated after mm_trim not zero at %d\n", i);
+			nerrors++;
+			break;
+		}
+	}
+	memset(p, 0xFF, TRIM_CHECK);
+	mm_free(p);
+	return nerrors;
+}
+
+/** Number of objects of each size allocated by test_batch() */
+#define BATCH_COUNT 100
+
+/**
+ * Test batch allocation with mm_malloc_batch() and mm_malloc_multi()
+ * and batch free with mm_free_batch(): each object must be usable
+ * for its size and not overlap the others, and all must be freed.
+ *
+ * @param debug true to print each error
+ * @return the number of errors
+ */
+static int test_batch(bool debug) {
+	static const size_t batch_sizes[] = { 24, 1000 };
+	static const size_t multi_sizes[] = { 10, 300, 5000, 1, 64 };
+	const int nbatch = sizeof(batch_sizes)/sizeof(batch_sizes[0]);
+	const int nmulti = sizeof(multi_sizes)/sizeof(multi_sizes[0]);
+	void *ptrs[nbatch * BATCH_COUNT + nmulti + 1];
+	size_t sizes[nbatch * BATCH_COUNT + nmulti + 1];
+	int nerrors = 0;
+	size_t n = 0;
+
+	for (int i = 0; i < nbatch; i++) {
+		size_t count = mm_malloc_batch(batch_sizes[i], BATCH_COUNT, ptrs + n);
+		if (count != BATCH_COUNT) {
+			if (debug) fprintf(stderr, "batch of %d objects of %zu bytes: %zu allocated\n",
+					BATCH_COUNT, batch_sizes[i], count);
+			nerrors++;
+		}
+		for (size_t k = 0; k < count; k++) {
+			sizes[n++] = batch_sizes[i];
+		}
+	}
+	if (mm_malloc_multi(nmulti, multi_sizes, ptrs + n) == NULL) {
+		if (debug) fprintf(stderr, "multi allocation of %d objects failed\n", nmulti);
+		nerrors++;
+	} else {
+		for (int i = 0; i < nmulti; i++) {
+			sizes[n++] = multi_sizes[i];
+		}
+	}
+
+	// fill every object, then check that no other object overwrote it
+	for (size_t i = 0; i < n; i++) {
+		if (mm_malloc_usable_size(ptrs[i]) < sizes[i]) {
+			if (debug) fprintf(stderr, "batch object %zu: usable size %zu less than %zu\n",
+					i, mm_malloc_usable_size(ptrs[i]), sizes[i]);
+			nerrors++;
+		}
+		memset(ptrs[i], i & 0xFF, sizes[i]);
+	}
+	for (size_t i = 0; i < n; i++) {
+		for (size_t k = 0; k < sizes[i]; k++) {
+			if (*((unsigned char *)ptrs[i] + k) != (i & 0xFF)) {
+				if (debug) fprintf(stderr, "batch object %zu overlaps another\n", i);
+				nerrors++;
+				break;
+			}
+		}
+	}
+
+	// NULL pointers are ignored
+	ptrs[n++] = NULL;
+	mm_free_batch(ptrs, n);
+
+	struct mm_stats stats;
+	mm_stats(&stats);
+	if (stats.alloc_blocks != 0) {
+		if (debug) fprintf(stderr, "%zu batch objects not freed\n", stats.alloc_blocks);
+		nerrors++;
+	}
+	return nerrors;
+}
+
+#ifdef MM_THREAD_SAFE
+/** Objects allocated by each thread of test_threads() */
+#define THREAD_OBJECTS 20000
+/** Objects that may wait in the queue of a thread of test_threads() */
+#define THREAD_QUEUE 64
+
+/** Object passed from one thread of test_threads() to another */
+typedef struct {
+	unsigned char *p;	/* the object */
+	size_t size;		/* bytes requested, each set to thread_fill(size) */
+} ThreadObj;
+
+/** Queue of the objects freed by a thread of test_threads() */
+typedef struct {
+	pthread_mutex_t lock;
+	ThreadObj objs[THREAD_QUEUE];
+	int head;			/* index of the first object */
+	int count;			/* number of objects */
+} ThreadQueue;
+
+/** State of a thread of test_threads() */
+typedef struct {
+	int id;				/* index of the thread */
+	int nthreads;		/* number of threads */
+	ThreadQueue *queues;	/* the queue of each thread */
+	int *running;		/* number of threads still allocating */
+	bool debug;			/* true to print each error */
+	int nerrors;		/* errors found by the thread */
+} ThreadArg;
+
+/**
+ * Returns the byte an object of the given size is filled with.
+ *
+ * @param size the size of the object
+ * @return the fill byte
+ */
+inline static unsigned char thread_fill(size_t size) {
+	return (unsigned char)(size % 251 + 1);
+}
+
+/**
+ * Returns a random object size for test_threads(): mostly small
+ * sizes, some multiples of 16 to use the size given to
+ * mm_free_sized(), and some large sizes.
+ *
+ * @param seed the random seed of the thread
+ * @return the size
+ */
+static size_t thread_size(unsigned *seed) {
+	switch (rand_r(seed) % 8) {
+	case 0:
+		return rand_r(seed) % 16384 + 1;
+	case 1: case 2:
+		return (rand_r(seed) % 32 + 1) * 16;
+	default:
+		return rand_r(seed) % 512 + 1;
+	}
+}
+
+/**
+ * Checks an object passed to a thread of test_threads(), reallocates
+ * some objects and checks realloc kept their content, then frees the
+ * object with mm_free() or mm_free_sized().
+ *
+ * @param ta the state of the thread
+ * @param obj the object
+ * @param seed the random seed of the thread
+ */
+static void thread_free(ThreadArg *ta, ThreadObj obj, unsigned *seed) {
+	unsigned char fill = thread_fill(obj.size);
+	for (size_t k = 0; k < obj.size; k++) {
+		if (obj.p[k] != fill) {
+			if (ta->debug) fprintf(stderr, "thread %d: object of %zu bytes overwritten\n",
+									ta->id, obj.size);
+			ta->nerrors++;
+			break;
+		}
+	}
+	if (rand_r(seed) % 4 == 0) {
+		size_t size = thread_size(seed);
+		unsigned char *p = mm_realloc(obj.p, size);
+		if (p == NULL) {
+			if (ta->debug) fprintf(stderr, "thread %d: realloc of %zu to %zu bytes failed\n",
+									ta->id, obj.size, size);
+			ta->nerrors++;
+		} else {
+			size_t kept = (size < obj.size) ? size : obj.size;
+			for (size_t k = 0; k < kept; k++) {
+				if (p[k] != fill) {
+					if (ta->debug) fprintf(stderr, "thread %d: realloc of %zu to %zu bytes "
+											"lost content\n", ta->id, obj.size, size);
+					ta->nerrors++;
+					break;
+				}
+			}
+			obj.p = p;
+			obj.size = size;
+		}
+	}
+	if (rand_r(seed) % 2 == 0) {
+		mm_free_sized(obj.p, obj.size);
+	} else {
+		mm_free(obj.p);
+	}
+}
+
+/**
+ * Pops the first object of a queue of test_threads().
+ *
+ * @param q the queue
+ * @param obj the object popped
+ * @return true if the queue had an object
+ */
+static bool thread_pop(ThreadQueue *q, ThreadObj *obj) {
+	pthread_mutex_lock(&q->lock);
+	bool found = q->count > 0;
+	if (found) {
+		*obj = q->objs[q->head];
+		q->head = (q->head + 1) % THREAD_QUEUE;
+		q->count--;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+/**
+ * Pushes an object on a queue of test_threads().
+ *
+ * @param q the queue
+ * @param obj the object
+ * @return true if the queue was not full
+ */
+static bool thread_push(ThreadQueue *q, ThreadObj obj) {
+	pthread_mutex_lock(&q->lock);
+	bool pushed = q->count < THREAD_QUEUE;
+	if (pushed) {
+		q->objs[(q->head + q->count) % THREAD_QUEUE] = obj;
+		q->count++;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return pushed;
+}
+
+/**
+ * A thread of test_threads(): allocates objects, fills them, and
+ * passes them to the next thread to free, while it frees those
+ * passed by the previous thread.
+ *
+ * @param arg the state of the thread
+ * @return NULL
+ */
+static void *test_thread(void *arg) {
+	ThreadArg *ta = arg;
+	ThreadQueue *in = &ta->queues[ta->id];
+	ThreadQueue *out = &ta->queues[(ta->id + 1) % ta->nthreads];
+	unsigned seed = ta->id + 1;
+	ThreadObj obj;
+
+	for (int i = 0; i < THREAD_OBJECTS; i++) {
+		obj.size = thread_size(&seed);
+		bool zeroed = rand_r(&seed) % 4 == 0;
+		obj.p = zeroed ? mm_calloc(1, obj.size) : mm_malloc(obj.size);
+		if (obj.p == NULL) {
+			if (ta->debug) fprintf(stderr, "thread %d: allocation of %zu bytes failed\n",
+									ta->id, obj.size);
+			ta->nerrors++;
+			continue;
+		}
+		for (size_t k = 0; zeroed && k < obj.size; k++) {
+			if (obj.p[k] != 0) {
+				if (ta->debug) fprintf(stderr, "thread %d: calloc of %zu bytes not zero\n",
+										ta->id, obj.size);
+				ta->nerrors++;
+				break;
+			}
+		}
+		memset(obj.p, thread_fill(obj.size), obj.size);
+		if (!thread_push(out, obj)) {
+			thread_free(ta, obj, &seed);
+		}
+		if (thread_pop(in, &obj)) {
+			thread_free(ta, obj, &seed);
+		}
+		if (i % 1000 == 0) {
+			// read the statistics while other threads allocate
+			struct mm_stats stats;
+			mm_stats(&stats);
+		}
+	}
+
+	// free the objects passed until every thread stops allocating
+	__atomic_sub_fetch(ta->running, 1, __ATOMIC_RELEASE);
+	for (;;) {
+		bool last = __atomic_load_n(ta->running, __ATOMIC_ACQUIRE) == 0;
+		while (thread_pop(in, &obj)) {
+			thread_free(ta, obj, &seed);
+		}
+		if (last) {
+			break;
+		}
+		sched_yield();
+	}
+	return NULL;
+}
+
+/**
+ * Test the thread-safe heap: each thread allocates objects and
+ * passes them to the next, which runs on another arena, to check,
+ * reallocate and free with mm_free() or mm_free_sized(). Once the
+ * threads end and the heap is trimmed, mm_stats() must report
+ * no allocated memory and the heap must shrink to TRIM_SLACK.
+ *
+ * @param debug true to print each error
+ * @param nthreads the number of threads
+ * @return the number of errors
+ */
+static int test_threads(bool debug, int nthreads) {
+	int nerrors = 0;
+	int running = nthreads;
+	ThreadQueue queues[nthreads];
+	ThreadArg args[nthreads];
+	pthread_t threads[nthreads];
+
+	for (int i = 0; i < nthreads; i++) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+		queues[i].head = queues[i].count = 0;
+		args[i] = (ThreadArg){ .id = i, .nthreads = nthreads, .queues = queues,
+							   .running = &running, .debug = debug, .nerrors = 0 };
+	}
+	int started = 0;
+	for (; started < nthreads; started++) {
+		if (pthread_create(&threads[started], NULL, test_thread, &args[started]) != 0) {
+			if (debug) fprintf(stderr, "cannot create thread %d\n", started);
+			nerrors++;
+			// threads that did not start stop allocating
+			__atomic_sub_fetch(&running, nthreads - started, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		nerrors += args[i].nerrors;
+	}
+	for (int i = 0; i < nthreads; i++) {
+		pthread_mutex_destroy(&queues[i].lock);
+	}
+
+	// the caches of the threads were emptied as they exited
+	mm_trim(0);
+	struct mm_stats stats;
+	mm_stats(&stats);
+	if (stats.alloc_blocks != 0 || stats.alloc_bytes != 0) {
+		if (debug) fprintf(stderr, "%zu blocks of %zu bytes not freed by threads\n",
+							stats.alloc_blocks, stats.alloc_bytes);
+		nerrors++;
+	}
+	if (mem_heapsize() > TRIM_SLACK) {
+		if (debug) fprintf(stderr, "heap %zu bytes after threads and mm_trim\n",
+							mem_heapsize());
+		nerrors++;
+	}
+	return nerrors;
+}
+#endif
+
 /**
  * This function fixes up argv arguments when run under GDB
  * on Eclipse CDT. Eclipse adds single-quotes around all
@@ -68,12 +609,66 @@ int main(int argc, char *argv[]) {
 	char c;
 	bool verbose = false;
 	bool debug = false;
+	bool reserve = false;
+	bool useheap = false;
+	bool bench = false;
+	bool aligned = false;
+	bool usable = false;
+	bool batch = false;
+	bool sized = false;
+	bool zeroed = false;
+	bool trim = false;
+	int nthreads = 0;
 	fixup(argc, argv);  // works around Eclipse debugging error
-    while ((c = getopt(argc, argv, "dhv")) != EOF) {
+    while ((c = getopt(argc, argv, "dhvrHbaumsztM:T:")) != EOF) {
         switch (c) {
         case 'd':
         	debug = true;
         	break;
+        case 'r': /* Pre-extend the heap for each trace */
+            reserve = true;
+            break;
+        case 'H': /* Allocate from a heap handle */
+            useheap = true;
+            break;
+        case 'b': /* Benchmark a region against mm_malloc */
+            bench = true;
+            break;
+        case 'a': /* Test aligned allocation */
+            aligned = true;
+            break;
+        case 'u': /* Use the usable size of blocks */
+            usable = true;
+            break;
+        case 'm': /* Test batch allocation */
+            batch = true;
+            break;
+        case 's': /* Free blocks with their sizes */
+            sized = true;
+            break;
+        case 'z': /* Allocate blocks with mm_calloc */
+            zeroed = true;
+            break;
+        case 't': /* Test trimming the heap after each trace */
+            trim = true;
+            break;
+        case 'M': /* Limit the heap size in megabytes */
+            if (atol(optarg) <= 0 || mem_set_maxheapsize((size_t)atol(optarg) << 20) != 0) {
+            	fprintf(stderr, "invalid heap limit: %s\n", optarg);
+            	return EXIT_FAILURE;
+            }
+            break;
+        case 'T': /* Test allocation by several threads */
+            nthreads = atoi(optarg);
+            if (nthreads <= 0) {
+            	fprintf(stderr, "invalid thread count: %s\n", optarg);
+            	return EXIT_FAILURE;
+            }
+#ifndef MM_THREAD_SAFE
+            fprintf(stderr, "-T requires a heap built with -DMM_THREAD_SAFE -pthread\n");
+            return EXIT_FAILURE;
+#endif
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = true;
             break;
@@ -93,9 +688,24 @@ int main(int argc, char *argv[]) {
     	return EXIT_FAILURE;
     }
 
-    // init memory model with default size
+    // init memory model with default or -M size
     mm_init();
 
+    if (aligned) {
+    	fprintf(stderr, "Aligned allocation: %d errors\n", test_aligned(debug));
+    	mm_reset();
+    }
+    if (batch) {
+    	fprintf(stderr, "Batch allocation: %d errors\n", test_batch(debug));
+    	mm_reset();
+    }
+#ifdef MM_THREAD_SAFE
+    if (nthreads > 0) {
+    	fprintf(stderr, "Threaded allocation: %d errors\n", test_threads(debug, nthreads));
+    	mm_reset();
+    }
+#endif
+
     // allocate array for trace results
     TraceInfo results[argc-optind];
 
@@ -116,11 +726,21 @@ int main(int argc, char *argv[]) {
 		int num_ops;
 		int weight;
 
-		fscanf(tracefile, "%d", &heapsize); /* not used */
+		fscanf(tracefile, "%d", &heapsize); /* suggested heap size */
 		fscanf(tracefile, "%d", &num_ids);
 		fscanf(tracefile, "%d", &num_ops);
 		fscanf(tracefile, "%d", &weight);        /* not used */
 
+		if (reserve && mm_reserve(heapsize) != 0) {
+			if (verbose) fprintf(stderr, "Cannot reserve %d bytes\n", heapsize);
+		}
+
+		/* heap handle for the blocks of the trace, or NULL for mm_malloc() */
+		mm_heap_t *heap = useheap ? mm_heap_create() : NULL;
+		if (useheap && heap == NULL) {
+			if (verbose) fprintf(stderr, "Cannot create heap\n");
+		}
+
 		/* We'll keep an array of pointers to the allocated blocks here... */
 		size_t block_sizes[num_ids];
 		memset(block_sizes, 0, num_ids * sizeof(size_t));
@@ -128,6 +748,16 @@ int main(int argc, char *argv[]) {
 		void* blocks[num_ids];
 		memset(blocks, 0, num_ids * sizeof(void*));
 
+		/* usable sizes of the blocks, and reallocs within them skipped */
+		size_t usable_sizes[num_ids];
+		memset(usable_sizes, 0, num_ids * sizeof(size_t));
+		int nskipped = 0;
+		bool use_usable = usable && heap == NULL;
+
+		/* sizes of the allocations for the benchmark */
+		int alloc_sizes[num_ops];
+		int nallocs = 0;
+
 		/* read every request line in the trace file */
 		int index = 0;
 		int op_index = 0;
@@ -135,6 +765,8 @@ int main(int argc, char *argv[]) {
 		int size;
 		char type[2];
 		int nerrors = 0;
+		size_t livebytes = 0;
+		size_t peakbytes = 0;
 		clock_t elapsed_time = 0;
 		if (debug || verbose) fprintf(stderr, "Processing trace file %s\n",
 				results[traceindex].traceName);
@@ -149,20 +781,44 @@ int main(int argc, char *argv[]) {
 					nerrors++;
 				} else {
 					max_index = (index > max_index) ? index : max_index;
+					alloc_sizes[nallocs++] = size;
 					time_t t = clock();
-					blocks[index] = mm_malloc(size);
+					if (heap != NULL) {
+						blocks[index] = mm_heap_malloc(heap, size);
+					} else if (use_usable) {
+						blocks[index] = mm_malloc_at_least(size, &usable_sizes[index]);
+					} else if (zeroed) {
+						blocks[index] = mm_calloc(1, size);
+					} else {
+						blocks[index] = mm_malloc(size);
+					}
 					elapsed_time += clock()-t;
 					if (blocks[index] == NULL) {
 						if (debug) fprintf(stderr, "  Block %u not allocated\n", index);
 						nerrors++;
 					} else {
 						if (debug && verbose) fprintf(stderr, "  Allocated block %u size %u\n", index, size);
+						if (zeroed && heap == NULL && !use_usable) {
+							for (int i = 0; i < size; i++) {
+								if (*((char*)blocks[index]+i) != 0) {
+									if (debug) fprintf(stderr, "  Block %u not zero at %d\n", index, i);
+									nerrors++;
+									break;
+								}
+							}
+						}
 						/*
 						 * fill range with low byte of index to make sure that the old
 						 * data was copied to the new block on realloc or free
 						 */
-						memset(blocks[index], (index & 0xFF), size);
+						memset(blocks[index], (index & 0xFF), use_usable ? usable_sizes[index] : (size_t)size);
+						if (use_usable && usable_sizes[index] < (size_t)size) {
+							if (debug) fprintf(stderr, "  Block %u usable size %zu less than %u\n",
+												index, usable_sizes[index], size);
+							nerrors++;
+						}
 						block_sizes[index] = size;
+						livebytes += size;
 					}
 				}
 				break;
@@ -173,7 +829,7 @@ int main(int argc, char *argv[]) {
 					if (debug) fprintf(stderr, "  Block %u not reallocated\n", index);
 					nerrors++;
 				} else {
-					for (int i = 0; i < block_sizes[index]; i++) {
+					for (size_t i = 0; i < block_sizes[index]; i++) {
 						if (*((char*)blocks[index]+i) != (char)(index & 0xFF)) {
 							if (debug) fprintf(stderr, "  Block %u has unexpected data before realloc.\n", index);
 							nerrors++;
@@ -186,7 +842,18 @@ int main(int argc, char *argv[]) {
 						}
 					}
 					time_t t = clock();
-					void *b = mm_realloc(blocks[index], size);
+					void *b;
+					if (use_usable && (size_t)size <= usable_sizes[index]) {
+						// the block already holds size bytes
+						b = blocks[index];
+						nskipped++;
+					} else {
+						b = (heap != NULL) ? mm_heap_realloc(heap, blocks[index], size)
+										   : mm_realloc(blocks[index], size);
+						if (b != NULL && use_usable) {
+							usable_sizes[index] = mm_malloc_usable_size(b);
+						}
+					}
 					elapsed_time += clock()-t;
 					if (b == NULL) {
 						if (debug) fprintf(stderr, "  Unable to realloc block %u to size %u\n", index, size);
@@ -194,7 +861,7 @@ int main(int argc, char *argv[]) {
 					} else {
 						if (debug && verbose) fprintf(stderr, "  Reallocated block %u size %u\n", index, size);
 						blocks[index] = b;
-						for (int i = 0; i < block_sizes[index]; i++) {
+						for (size_t i = 0; i < block_sizes[index]; i++) {
 							if (*((char*)blocks[index]+i) != (char)(index & 0xFF)) {
 								if (debug) fprintf(stderr, "  Block %u has unexpected data after reallocation.\n", index);
 								nerrors++;
@@ -206,6 +873,7 @@ int main(int argc, char *argv[]) {
 						 * data was copied to the new block on realloc or free
 						 */
 						memset(blocks[index], (index & 0xFF), size);
+						livebytes += size - block_sizes[index];
 						block_sizes[index] = size;
 					}
 				}
@@ -217,7 +885,7 @@ int main(int argc, char *argv[]) {
 					nerrors++;
 				} else {
 					if (debug & verbose) fprintf(stderr, "  Freeing block %u size %zu\n", index, block_sizes[index]);
-					for (int i = 0; i < block_sizes[index]; i++) {
+					for (size_t i = 0; i < block_sizes[index]; i++) {
 						if (*((char*)blocks[index]+i) != (char)(index & 0xFF)) {
 							if (debug) fprintf(stderr, "  Block %u has unexpected data before free.\n", index);
 							nerrors++;
@@ -225,10 +893,17 @@ int main(int argc, char *argv[]) {
 						}
 					}
 					time_t t = clock();
-					mm_free(blocks[index]);
+					if (heap != NULL) {
+						mm_heap_free(heap, blocks[index]);
+					} else if (sized) {
+						mm_free_sized(blocks[index], block_sizes[index]);
+					} else {
+						mm_free(blocks[index]);
+					}
 					elapsed_time += clock()-t;
 					if (debug & verbose) fprintf(stderr, "  Freed block %u size %zu\n", index, block_sizes[index]);
 					blocks[index] = NULL;
+					livebytes -= block_sizes[index];
 					block_sizes[index] = 0;
 				}
 				break;
@@ -238,6 +913,7 @@ int main(int argc, char *argv[]) {
 				nerrors++;
 			}
 
+			peakbytes = (livebytes > peakbytes) ? livebytes : peakbytes;
 			op_index++;
 		}
 		fclose(tracefile);
@@ -254,18 +930,52 @@ int main(int argc, char *argv[]) {
 		// tally and report leaks
 		char *newline = "\n";
 		for (int i = 0; i < num_ids; i++) {
-			if (blocks[index] != NULL) {
+			if (blocks[i] != NULL) {
 				if (debug) fprintf(stderr, "%sblock %d not freed, size=%zu\n", newline, i, block_sizes[i]);
 				results[traceindex].leaks++;
 				newline = "";
 			}
 		}
 
+		// destroying the heap handle frees the blocks not freed
+		size_t expected = results[traceindex].leaks;
+		if (heap != NULL) {
+			mm_heap_destroy(heap);
+			expected = 0;
+		}
+
+		// heap statistics must count the blocks not freed
+		struct mm_stats stats;
+		mm_stats(&stats);
+		if (stats.alloc_blocks != expected) {
+			if (debug) fprintf(stderr, "heap statistics count %zu allocated blocks\n", stats.alloc_blocks);
+			results[traceindex].errors++;
+		}
+		if (verbose) fprintf(stderr, "Free: %zu bytes in %zu blocks, largest %zu\n"
+				"Allocated: %zu bytes in %zu blocks\n"
+				"Heap: %zu bytes, peak %zu bytes, %zu sbrk calls\n",
+				stats.free_bytes, stats.free_blocks, stats.largest_free,
+				stats.alloc_bytes, stats.alloc_blocks,
+				stats.heap_size, stats.peak_heap, stats.sbrk_calls);
+
+		if (use_usable && (debug || verbose)) fprintf(stderr,
+				"Reallocs within the usable size: %d\n", nskipped);
 		if (debug || verbose) fprintf(stderr, "Errors: %d, leaks: %d\n\n",
 				results[traceindex].errors, results[traceindex].leaks);
 
 		results[traceindex].secs = ((double) (elapsed_time)) / CLOCKS_PER_SEC;
 		results[traceindex].ops = op_index;
+		results[traceindex].heapsize = mem_heapsize();
+		results[traceindex].peakbytes = peakbytes;
+
+		if (trim) {
+			// blocks of a heap handle were freed with the heap
+			results[traceindex].errors += test_trim(debug, blocks, (heap != NULL) ? 0 : num_ids);
+		}
+
+		if (bench) {
+			benchmark(results[traceindex].traceName, alloc_sizes, nallocs);
+		}
 
 		// reset memory model for next test
 		mm_reset();
@@ -274,14 +984,16 @@ int main(int argc, char *argv[]) {
 
     /* Print the individual results for each trace */
     if (verbose) fprintf(stderr, "\nResults for traces:\n");
-	fprintf(stderr, "%5s%7s%7s%8s%10s%8s  %s\n",
-	   "index", "leaks", "errors", "ops", "secs", "Kops", "file");
+	fprintf(stderr, "%5s%7s%7s%8s%10s%8s%9s%6s  %s\n",
+	   "index", "leaks", "errors", "ops", "secs", "Kops", "heapKB", "util", "file");
 
     for (int i = 0; i < traceindex; i++) {
     	if (results[i].ops > 0) {
-			fprintf(stderr, "%5d%7d%7d%8d%10.6f%8d  %s\n",
+			fprintf(stderr, "%5d%7d%7d%8d%10.6f%8d%9zu%5d%%  %s\n",
 					i+1, results[i].leaks, results[i].errors, results[i].ops, results[i].secs,
-					(int)(results[i].ops/1e3/results[i].secs), results[i].traceName);
+					(int)(results[i].ops/1e3/results[i].secs), results[i].heapsize/1024,
+					(results[i].heapsize > 0) ? (int)(100.0*results[i].peakbytes/results[i].heapsize) : 0,
+					results[i].traceName);
     	}
     }
 